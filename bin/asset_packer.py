@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+
+# Pack the asset directory into a single indexed archive.
+#
+# Usage: asset_packer.py <out.pak> <asset_dir>
+#
+# Layout (little endian), read by src/asset_pack.cpp:
+#
+#   header   magic "AHIEPAK1", u32 entry count, u32 size of the name table
+#   index    one 32 bytes record per entry, sorted by name (byte order):
+#            u64 offset, u64 stored size, u64 size, u32 name offset,
+#            u16 name length, u8 compression (0: raw, 1: lz4 block), u8 pad
+#   names    concatenated utf-8 names, relative to <asset_dir>, '/' separated
+#   data     entries, each aligned on ALIGNMENT bytes
+#
+# Raw entries can be used in place from the memory-mapped archive. Formats
+# that are already compressed (png, ogg) are always stored raw, other files
+# are LZ4-compressed when it is worth it.
+
+from sys import argv, exit
+from os import walk
+from os.path import join, relpath, splitext
+import struct
+
+
+MAGIC       = b"AHIEPAK1"
+ALIGNMENT   = 16
+RAW         = 0
+LZ4         = 1
+STORE_RAW   = { ".png", ".ogg" }
+# Compressed entries must save at least that fraction of their size.
+MIN_SAVING  = .1
+
+MIN_MATCH   = 4
+MF_LIMIT    = 12
+LAST_LITERALS = 5
+MAX_OFFSET  = 65535
+
+
+def lz4_length(out, length):
+	while length >= 255:
+		out.append(255)
+		length -= 255
+	out.append(length)
+
+
+def lz4_sequence(out, literals, offset, match_length):
+	lit = len(literals)
+	ml = match_length - MIN_MATCH if offset else 0
+	out.append((min(lit, 15) << 4) | min(ml, 15))
+	if lit >= 15:
+		lz4_length(out, lit - 15)
+	out += literals
+	if offset:
+		out += struct.pack("<H", offset)
+		if ml >= 15:
+			lz4_length(out, ml - 15)
+
+
+def lz4_compress(data):
+	"""Greedy LZ4 block compressor, compatible with LZ4_decompress_safe."""
+	n = len(data)
+	out = bytearray()
+	table = {}
+	anchor = 0
+	p = 0
+	while p < n - MF_LIMIT:
+		key = data[p:p + MIN_MATCH]
+		ref = table.get(key)
+		table[key] = p
+		if ref is None or p - ref > MAX_OFFSET:
+			p += 1
+			continue
+		length = MIN_MATCH
+		while p + length < n - LAST_LITERALS and data[ref + length] == data[p + length]:
+			length += 1
+		lz4_sequence(out, data[anchor:p], p - ref, length)
+		p += length
+		anchor = p
+	lz4_sequence(out, data[anchor:], 0, 0)
+	return bytes(out)
+
+
+def pack_entry(name, data):
+	base, ext = splitext(name)
+	if ext.lower() not in STORE_RAW and len(data) > MF_LIMIT:
+		compressed = lz4_compress(data)
+		if len(compressed) <= len(data) * (1 - MIN_SAVING):
+			return LZ4, compressed
+	return RAW, data
+
+
+if len(argv) != 3:
+	print("Usage: {} <out.pak> <asset_dir>".format(argv[0]))
+	exit(1)
+
+out_file, asset_dir = argv[1:]
+
+files = []
+for root, dirs, names in walk(asset_dir):
+	for name in names:
+		path = join(root, name)
+		files.append((relpath(path, asset_dir).replace("\\", "/").encode("utf-8"), path))
+files.sort()
+
+names = b"".join(name for name, path in files)
+header_size = len(MAGIC) + 8
+data_offset = header_size + 32 * len(files) + len(names)
+
+index = bytearray()
+blobs = bytearray()
+name_offset = 0
+offset = data_offset
+for name, path in files:
+	with open(path, "rb") as f:
+		data = f.read()
+	compression, stored = pack_entry(name.decode("utf-8"), data)
+
+	padding = -offset % ALIGNMENT
+	blobs += bytes(padding)
+	offset += padding
+
+	index += struct.pack("<QQQIHBB", offset, len(stored), len(data),
+	                     name_offset, len(name), compression, 0)
+	blobs += stored
+	offset += len(stored)
+	name_offset += len(name)
+
+	print("{}: {} -> {}{}".format(name.decode("utf-8"), len(data), len(stored),
+	                              " (lz4)" if compression == LZ4 else ""))
+
+with open(out_file, "wb") as f:
+	f.write(MAGIC)
+	f.write(struct.pack("<II", len(files), len(names)))
+	f.write(index)
+	f.write(names)
+	f.write(blobs)
+
+print("{}: {} entries, {} bytes".format(out_file, len(files), offset))
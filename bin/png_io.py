@@ -0,0 +1,96 @@
+# Minimal PNG reader / writer used by the asset preprocessing tools.
+#
+# Only supports 8 bits per channel, non-interlaced images, which is what our
+# assets use. Images are returned as (width, height, channels, rows), each row
+# being a bytearray of width * channels bytes.
+
+from struct import pack, unpack
+from zlib import compress, crc32, decompress
+
+
+_SIGNATURE = b'\x89PNG\r\n\x1a\n'
+_CHANNELS  = { 0: 1, 2: 3, 4: 2, 6: 4 }
+
+
+def paeth(a, b, c):
+	p = a + b - c
+	pa = abs(p - a)
+	pb = abs(p - b)
+	pc = abs(p - c)
+	if pa <= pb and pa <= pc:
+		return a
+	if pb <= pc:
+		return b
+	return c
+
+
+def read_png(filename):
+	data = open(filename, 'rb').read()
+	if data[:8] != _SIGNATURE:
+		raise RuntimeError("{}: not a png file".format(filename))
+
+	pos = 8
+	idat = []
+	while pos < len(data):
+		length, kind = unpack('>I4s', data[pos:pos+8])
+		chunk = data[pos+8:pos+8+length]
+		if kind == b'IHDR':
+			width, height, depth, color, _, _, interlace = unpack('>IIBBBBB', chunk)
+		elif kind == b'IDAT':
+			idat.append(chunk)
+		pos += length + 12
+
+	if depth != 8 or interlace:
+		raise RuntimeError("{}: only 8 bits non-interlaced images are supported".format(filename))
+	channels = _CHANNELS.get(color)
+	if channels is None:
+		raise RuntimeError("{}: unsupported color type {}".format(filename, color))
+
+	raw = decompress(b''.join(idat))
+	stride = width * channels
+	rows = []
+	prev = bytearray(stride)
+	for y in range(height):
+		base = y * (stride + 1)
+		kind = raw[base]
+		row = bytearray(raw[base + 1:base + 1 + stride])
+		if kind == 1:
+			for i in range(channels, stride):
+				row[i] = (row[i] + row[i - channels]) & 0xff
+		elif kind == 2:
+			for i in range(stride):
+				row[i] = (row[i] + prev[i]) & 0xff
+		elif kind == 3:
+			for i in range(stride):
+				left = row[i - channels] if i >= channels else 0
+				row[i] = (row[i] + ((left + prev[i]) >> 1)) & 0xff
+		elif kind == 4:
+			for i in range(stride):
+				left = row[i - channels] if i >= channels else 0
+				up_left = prev[i - channels] if i >= channels else 0
+				row[i] = (row[i] + paeth(left, prev[i], up_left)) & 0xff
+		rows.append(row)
+		prev = row
+
+	return width, height, channels, rows
+
+
+def _chunk(kind, data):
+	return pack('>I', len(data)) + kind + data + pack('>I', crc32(kind + data) & 0xffffffff)
+
+
+def write_png(filename, width, height, channels, rows):
+	color = { c: t for t, c in _CHANNELS.items() }[channels]
+	# Rows are stored with the "up" filter, cheap and good enough for sprites.
+	raw = bytearray()
+	prev = bytearray(width * channels)
+	for row in rows:
+		raw.append(2)
+		raw.extend((a - b) & 0xff for a, b in zip(row, prev))
+		prev = row
+
+	with open(filename, 'wb') as out:
+		out.write(_SIGNATURE)
+		out.write(_chunk(b'IHDR', pack('>IIBBBBB', width, height, 8, color, 0, 0, 0)))
+		out.write(_chunk(b'IDAT', compress(bytes(raw), 9)))
+		out.write(_chunk(b'IEND', b''))
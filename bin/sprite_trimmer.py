@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+
+# Compute the trimmed bounds of each tile of mostly-transparent sprites.
+#
+# Usage: sprite_trimmer.py <output.json> <image.png>[:<htiles>x<vtiles>]...
+#
+# The output maps each image file name to its tile layout and, for each tile,
+# the box [x0, y0, x1, y1] that contains all its non-transparent pixels. Boxes
+# are normalized to the tile size with the origin at the bottom-left corner,
+# which is what SpriteComponent::setView expects. Boxes are padded by one
+# pixel so that bilinear filtering does not clip the edges.
+
+from sys import argv, exit
+from os.path import basename
+from json import dump
+
+from png_io import read_png
+
+
+PADDING = 1
+
+
+def alpha_mask(width, height, channels, rows):
+	if channels not in (2, 4):
+		return None
+	return [ row[channels - 1::channels] for row in rows ]
+
+
+def trim_tile(mask, x0, y0, x1, y1):
+	if mask is None:
+		return [ 0, 0, 1, 1 ]
+
+	tw = x1 - x0
+	th = y1 - y0
+	left, right, top, bottom = tw, -1, th, -1
+	for y in range(y0, y1):
+		line = mask[y][x0:x1]
+		if not any(line):
+			continue
+		top    = min(top, y - y0)
+		bottom = max(bottom, y - y0)
+		first = next(i for i, a in enumerate(line) if a)
+		last  = tw - 1 - next(i for i, a in enumerate(reversed(line)) if a)
+		left  = min(left, first)
+		right = max(right, last)
+
+	if right < 0:
+		# Fully transparent tile.
+		return [ 0, 0, 0, 0 ]
+
+	left   = max(left - PADDING, 0)
+	top    = max(top - PADDING, 0)
+	right  = min(right + 1 + PADDING, tw)
+	bottom = min(bottom + 1 + PADDING, th)
+
+	# Image rows go top to bottom, views go bottom to top.
+	return [ left / tw, 1 - bottom / th, right / tw, 1 - top / th ]
+
+
+if len(argv) < 3:
+	print("Usage: {} <output.json> <image.png>[:<htiles>x<vtiles>]...".format(argv[0]))
+	exit(1)
+
+json = {}
+for arg in argv[2:]:
+	filename, _, tiles = arg.partition(':')
+	htiles, vtiles = map(int, tiles.split('x')) if tiles else (1, 1)
+
+	width, height, channels, rows = read_png(filename)
+	mask = alpha_mask(width, height, channels, rows)
+
+	tw = width  // htiles
+	th = height // vtiles
+	views = []
+	for ty in range(vtiles):
+		for tx in range(htiles):
+			views.append(trim_tile(mask, tx * tw, ty * th,
+			                       (tx + 1) * tw, (ty + 1) * th))
+
+	total = float(width * height)
+	kept = sum((v[2] - v[0]) * (v[3] - v[1]) * tw * th for v in views)
+	print("{}: {:.0f}% of the pixels kept".format(filename, 100 * kept / total))
+
+	json[basename(filename)] = {
+		"tiles": [ htiles, vtiles ],
+		"views": views,
+	}
+
+dump(json, open(argv[1], 'w'), indent='\t')
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+
+# Generate pre-scaled variants of textures.
+#
+# Usage: texture_variants.py <image.png>...
+#
+# For each image "name.png", write "name@2.png" and "name@4.png", downscaled
+# by 2 and 4 with a box filter. TextureManager picks them at runtime depending
+# on the window size and the texture memory budget. Colors are weighted by
+# alpha so transparent pixels do not bleed dark fringes.
+
+from sys import argv, exit
+from os.path import splitext
+
+from png_io import read_png, write_png
+
+
+FACTORS = [ 2, 4 ]
+
+
+def half(width, height, channels, rows):
+	hw = max(width  // 2, 1)
+	hh = max(height // 2, 1)
+	has_alpha = channels in (2, 4)
+	out = []
+	for y in range(hh):
+		r0 = rows[min(2 * y,     height - 1)]
+		r1 = rows[min(2 * y + 1, height - 1)]
+		row = bytearray(hw * channels)
+		for x in range(hw):
+			i0 = min(2 * x,     width - 1) * channels
+			i1 = min(2 * x + 1, width - 1) * channels
+			samples = [ (r0, i0), (r0, i1), (r1, i0), (r1, i1) ]
+			o = x * channels
+			if has_alpha:
+				a = [ r[i + channels - 1] for r, i in samples ]
+				sa = sum(a)
+				row[o + channels - 1] = (sa + 2) // 4
+				for c in range(channels - 1):
+					if sa:
+						row[o + c] = (sum(r[i + c] * w for (r, i), w in zip(samples, a)) + sa // 2) // sa
+			else:
+				for c in range(channels):
+					row[o + c] = (sum(r[i + c] for r, i in samples) + 2) // 4
+		out.append(row)
+	return hw, hh, channels, out
+
+
+if len(argv) < 2:
+	print("Usage: {} <image.png>...".format(argv[0]))
+	exit(1)
+
+for filename in argv[1:]:
+	image = read_png(filename)
+	base, ext = splitext(filename)
+	factor = 1
+	for target in FACTORS:
+		while factor < target:
+			image = half(*image)
+			factor *= 2
+		variant = "{}@{}{}".format(base, factor, ext)
+		write_png(variant, *image)
+		print("{}: {}x{}".format(variant, image[0], image[1]))
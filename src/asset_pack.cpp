@@ -0,0 +1,541 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <SDL_rwops.h>
+
+#include "asset_pack.h"
+
+
+static const char   packMagic[8]   = { 'A', 'H', 'I', 'E', 'P', 'A', 'K', '1' };
+static const size_t packHeaderSize = 16;
+
+static_assert(sizeof(AssetPack::Entry) == 32, "AssetPack::Entry must match the file layout");
+
+
+// Decodes an LZ4 block (no frame). Checks every bound, the archive is not
+// trusted more than any other input file.
+static bool lz4Decompress(const uint8* src, size_t srcSize, uint8* dst, size_t dstSize) {
+	const uint8* ip   = src;
+	const uint8* iend = src + srcSize;
+	uint8*       op   = dst;
+	uint8*       oend = dst + dstSize;
+
+	while(ip < iend) {
+		unsigned token = *ip++;
+
+		size_t litLength = token >> 4;
+		if(litLength == 15) {
+			unsigned b;
+			do {
+				if(ip == iend) return false;
+				b = *ip++;
+				litLength += b;
+			} while(b == 255);
+		}
+		if(size_t(iend - ip) < litLength || size_t(oend - op) < litLength) {
+			return false;
+		}
+		std::memcpy(op, ip, litLength);
+		ip += litLength;
+		op += litLength;
+
+		// The last sequence only has literals.
+		if(ip == iend) {
+			break;
+		}
+
+		if(iend - ip < 2) {
+			return false;
+		}
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > size_t(op - dst)) {
+			return false;
+		}
+
+		size_t matchLength = token & 0x0f;
+		if(matchLength == 15) {
+			unsigned b;
+			do {
+				if(ip == iend) return false;
+				b = *ip++;
+				matchLength += b;
+			} while(b == 255);
+		}
+		matchLength += 4;
+		if(size_t(oend - op) < matchLength) {
+			return false;
+		}
+
+		// Matches may overlap the output, copy byte by byte.
+		const uint8* match = op - offset;
+		for(size_t i = 0; i < matchLength; ++i) {
+			op[i] = match[i];
+		}
+		op += matchLength;
+	}
+
+	return op == oend;
+}
+
+
+//---------------------------------------------------------------------------//
+
+
+// Read-only SDL stream that owns a decompressed buffer.
+struct BufferStream {
+	std::vector<uint8> data;
+	size_t             pos;
+};
+
+
+static BufferStream* bufferStream(SDL_RWops* rw) {
+	return static_cast<BufferStream*>(rw->hidden.unknown.data1);
+}
+
+
+static Sint64 bufferSize(SDL_RWops* rw) {
+	return bufferStream(rw)->data.size();
+}
+
+
+static Sint64 bufferSeek(SDL_RWops* rw, Sint64 offset, int whence) {
+	BufferStream* stream = bufferStream(rw);
+	Sint64 size = stream->data.size();
+	Sint64 pos;
+	switch(whence) {
+	case RW_SEEK_SET: pos = offset;               break;
+	case RW_SEEK_CUR: pos = stream->pos + offset; break;
+	case RW_SEEK_END: pos = size + offset;        break;
+	default:
+		return SDL_SetError("Unknown value for 'whence'");
+	}
+	stream->pos = std::max(Sint64(0), std::min(pos, size));
+	return stream->pos;
+}
+
+
+static size_t bufferRead(SDL_RWops* rw, void* ptr, size_t size, size_t maxNum) {
+	BufferStream* stream = bufferStream(rw);
+	if(size == 0) {
+		return 0;
+	}
+	size_t num = std::min(maxNum, (stream->data.size() - stream->pos) / size);
+	std::memcpy(ptr, stream->data.data() + stream->pos, num * size);
+	stream->pos += num * size;
+	return num;
+}
+
+
+static size_t bufferWrite(SDL_RWops*, const void*, size_t, size_t) {
+	SDL_SetError("Asset streams are read-only");
+	return 0;
+}
+
+
+static int bufferClose(SDL_RWops* rw) {
+	delete bufferStream(rw);
+	SDL_FreeRW(rw);
+	return 0;
+}
+
+
+//---------------------------------------------------------------------------//
+
+
+MappedFile::MappedFile()
+    : _data(nullptr),
+      _size(0),
+#ifdef _WIN32
+      _file(nullptr),
+      _mapping(nullptr),
+#endif
+      _buffer() {
+}
+
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+
+bool MappedFile::open(const Path& path) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.utf8CStr(), GENERIC_READ, FILE_SHARE_READ,
+	                          nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER size;
+		HANDLE mapping = GetFileSizeEx(file, &size)?
+		            CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr): nullptr;
+		const void* view = mapping? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0): nullptr;
+		if(view) {
+			_file    = file;
+			_mapping = mapping;
+			_data    = static_cast<const uint8*>(view);
+			_size    = size.QuadPart;
+			return true;
+		}
+		if(mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+	}
+#else
+	int fd = ::open(path.utf8CStr(), O_RDONLY);
+	if(fd >= 0) {
+		struct stat st;
+		void* view = MAP_FAILED;
+		if(fstat(fd, &st) == 0 && st.st_size > 0) {
+			view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		::close(fd);
+		if(view != MAP_FAILED) {
+			_data = static_cast<const uint8*>(view);
+			_size = st.st_size;
+			return true;
+		}
+	}
+#endif
+
+	// No mapping available: read the whole file once instead.
+	std::ifstream in(path.native(), std::ios::binary);
+	if(!in) {
+		return false;
+	}
+	in.seekg(0, std::ios::end);
+	_buffer.resize(in.tellg());
+	in.seekg(0, std::ios::beg);
+	if(!in.read(reinterpret_cast<char*>(_buffer.data()), _buffer.size())) {
+		_buffer.clear();
+		return false;
+	}
+	_data = _buffer.data();
+	_size = _buffer.size();
+	return true;
+}
+
+
+void MappedFile::close() {
+	if(!_data) {
+		return;
+	}
+
+	if(!_buffer.empty()) {
+		_buffer.clear();
+		_buffer.shrink_to_fit();
+	} else {
+#ifdef _WIN32
+		UnmapViewOfFile(_data);
+		CloseHandle(_mapping);
+		CloseHandle(_file);
+		_mapping = nullptr;
+		_file    = nullptr;
+#else
+		munmap(const_cast<uint8*>(_data), _size);
+#endif
+	}
+
+	_data = nullptr;
+	_size = 0;
+}
+
+
+bool MappedFile::isOpen() const {
+	return _data != nullptr;
+}
+
+
+const uint8* MappedFile::data() const {
+	return _data;
+}
+
+
+size_t MappedFile::size() const {
+	return _size;
+}
+
+
+//---------------------------------------------------------------------------//
+
+
+AssetPack::AssetPack()
+    : _file(),
+      _entries(nullptr),
+      _nEntries(0),
+      _names(nullptr) {
+}
+
+
+AssetPack::~AssetPack() {
+	close();
+}
+
+
+bool AssetPack::open(const Path& path, std::string* error) {
+	close();
+
+	if(!_file.open(path)) {
+		*error = "cannot read file";
+		return false;
+	}
+	const uint8* data = _file.data();
+	size_t       size = _file.size();
+
+	uint32 header[2];
+	if(size < packHeaderSize || std::memcmp(data, packMagic, sizeof(packMagic)) != 0) {
+		*error = "not an asset pack";
+		close();
+		return false;
+	}
+	std::memcpy(header, data + sizeof(packMagic), sizeof(header));
+
+	uint64 nEntries  = header[0];
+	uint64 namesSize = header[1];
+	if(packHeaderSize + nEntries * sizeof(Entry) + namesSize > size) {
+		*error = "truncated index";
+		close();
+		return false;
+	}
+
+	_entries  = reinterpret_cast<const Entry*>(data + packHeaderSize);
+	_nEntries = nEntries;
+	_names    = reinterpret_cast<const char*>(_entries + _nEntries);
+
+	for(unsigned i = 0; i < _nEntries; ++i) {
+		const Entry& e = _entries[i];
+		if(e.offset > size || e.storedSize > size - e.offset
+		|| uint64(e.nameOffset) + e.nameLength > namesSize
+		|| (e.compression == RAW && e.storedSize != e.size)
+		|| e.compression > LZ4) {
+			*error = "corrupted index";
+			close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+void AssetPack::close() {
+	_file.close();
+	_entries  = nullptr;
+	_nEntries = 0;
+	_names    = nullptr;
+}
+
+
+bool AssetPack::isOpen() const {
+	return _file.isOpen();
+}
+
+
+unsigned AssetPack::size() const {
+	return _nEntries;
+}
+
+
+const AssetPack::Entry* AssetPack::find(const std::string& file) const {
+	unsigned begin = 0;
+	unsigned end   = _nEntries;
+	while(begin < end) {
+		unsigned mid = (begin + end) / 2;
+		const Entry* e = _entries + mid;
+
+		// Byte-wise comparison, as the packer sorts the names.
+		int cmp = std::memcmp(name(e), file.data(), std::min<size_t>(e->nameLength, file.size()));
+		if(cmp == 0) {
+			cmp = int(e->nameLength) - int(file.size());
+		}
+
+		if(cmp == 0) {
+			return e;
+		} else if(cmp < 0) {
+			begin = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+	return nullptr;
+}
+
+
+const uint8* AssetPack::rawData(const Entry* entry) const {
+	return (entry->compression == RAW)? _file.data() + entry->offset: nullptr;
+}
+
+
+bool AssetPack::read(const Entry* entry, uint8* dst) const {
+	const uint8* src = _file.data() + entry->offset;
+	if(entry->compression == RAW) {
+		std::memcpy(dst, src, entry->size);
+		return true;
+	}
+	return lz4Decompress(src, entry->storedSize, dst, entry->size);
+}
+
+
+const char* AssetPack::name(const Entry* entry) const {
+	return _names + entry->nameOffset;
+}
+
+
+//---------------------------------------------------------------------------//
+
+
+AssetFs::AssetFs()
+    : _dataPath(),
+      _pack() {
+}
+
+
+const Path& AssetFs::dataPath() const {
+	return _dataPath;
+}
+
+
+void AssetFs::setDataPath(const Path& path) {
+	_dataPath = path;
+}
+
+
+bool AssetFs::mount(const Path& pack, std::string* error) {
+	return _pack.open(pack, error);
+}
+
+
+bool AssetFs::isPacked() const {
+	return _pack.isOpen();
+}
+
+
+bool AssetFs::exists(const std::string& file) const {
+	if(isPacked()) {
+		return _pack.find(file) != nullptr;
+	}
+	return std::ifstream((_dataPath / file).native()).good();
+}
+
+
+SDL_RWops* AssetFs::open(const std::string& file) const {
+	// Loose files are never looked up when a pack is mounted: each miss
+	// would cost a file open.
+	if(!isPacked()) {
+		return SDL_RWFromFile((_dataPath / file).utf8CStr(), "rb");
+	}
+
+	const AssetPack::Entry* entry = _pack.find(file);
+	if(!entry) {
+		SDL_SetError("\"%s\" is not in the asset pack", file.c_str());
+		return nullptr;
+	}
+
+	if(const uint8* data = _pack.rawData(entry)) {
+		return SDL_RWFromConstMem(data, entry->size);
+	}
+
+	BufferStream* stream = new BufferStream;
+	stream->data.resize(entry->size);
+	stream->pos = 0;
+	if(!_pack.read(entry, stream->data.data())) {
+		delete stream;
+		SDL_SetError("\"%s\" is corrupted", file.c_str());
+		return nullptr;
+	}
+
+	SDL_RWops* rw = SDL_AllocRW();
+	if(!rw) {
+		delete stream;
+		return nullptr;
+	}
+	rw->size  = bufferSize;
+	rw->seek  = bufferSeek;
+	rw->read  = bufferRead;
+	rw->write = bufferWrite;
+	rw->close = bufferClose;
+	rw->type  = SDL_RWOPS_UNKNOWN;
+	rw->hidden.unknown.data1 = stream;
+	return rw;
+}
+
+
+bool AssetFs::read(const std::string& file, std::string* data) const {
+	if(!isPacked()) {
+		std::ifstream in((_dataPath / file).native(), std::ios::binary);
+		if(!in) {
+			return false;
+		}
+		data->assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	const AssetPack::Entry* entry = _pack.find(file);
+	if(!entry) {
+		return false;
+	}
+	data->resize(entry->size);
+	return entry->size == 0
+	    || _pack.read(entry, reinterpret_cast<uint8*>(&(*data)[0]));
+}
+
+
+bool AssetFs::read(const std::string& file, AssetData* data) const {
+	data->buffer.clear();
+	if(!isPacked()) {
+		std::ifstream in((_dataPath / file).native(), std::ios::binary);
+		if(!in) {
+			return false;
+		}
+		data->buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		data->data = data->buffer.data();
+		data->size = data->buffer.size();
+		return true;
+	}
+
+	const AssetPack::Entry* entry = _pack.find(file);
+	if(!entry) {
+		return false;
+	}
+	data->size = entry->size;
+	data->data = _pack.rawData(entry);
+	if(data->data) {
+		return true;
+	}
+	data->buffer.resize(entry->size);
+	data->data = data->buffer.data();
+	return entry->size == 0
+	    || _pack.read(entry, data->buffer.data());
+}
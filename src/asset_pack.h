@@ -0,0 +1,166 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_ASSET_PACK_H
+#define _AHIE_ASSET_PACK_H
+
+
+#include <string>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/path.h>
+
+
+#define ASSET_PACK_FILE "assets.pak"
+
+
+struct SDL_RWops;
+
+
+using namespace lair;
+
+
+/// Read-only memory mapping of a whole file. Falls back to reading the file
+/// in memory when it cannot be mapped.
+class MappedFile {
+public:
+	MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	~MappedFile();
+
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const Path& path);
+	void close();
+	bool isOpen() const;
+
+	const uint8* data() const;
+	size_t size() const;
+
+protected:
+	const uint8* _data;
+	size_t       _size;
+#ifdef _WIN32
+	void*        _file;
+	void*        _mapping;
+#endif
+	std::vector<uint8>
+	             _buffer;
+};
+
+
+/// Read-only view of an archive built by bin/asset_packer.py.
+///
+/// The whole file is memory-mapped once; the index is sorted so lookups are a
+/// binary search. Raw entries are used in place, LZ4 entries are decompressed
+/// on read. All const methods can be called from any thread.
+class AssetPack {
+public:
+	enum Compression {
+		RAW = 0,
+		LZ4 = 1
+	};
+
+	struct Entry {
+		uint64 offset;
+		uint64 storedSize;
+		uint64 size;
+		uint32 nameOffset;
+		uint16 nameLength;
+		uint8  compression;
+		uint8  pad;
+	};
+
+public:
+	AssetPack();
+	AssetPack(const AssetPack&) = delete;
+	~AssetPack();
+
+	AssetPack& operator=(const AssetPack&) = delete;
+
+	bool open(const Path& path, std::string* error);
+	void close();
+	bool isOpen() const;
+
+	unsigned size() const;
+	const Entry* find(const std::string& file) const;
+
+	/// Pointer to the entry data if it is stored raw, null otherwise.
+	const uint8* rawData(const Entry* entry) const;
+	bool read(const Entry* entry, uint8* dst) const;
+
+protected:
+	const char* name(const Entry* entry) const;
+
+protected:
+	MappedFile   _file;
+	const Entry* _entries;
+	unsigned     _nEntries;
+	const char*  _names;
+};
+
+
+/// Content of an asset. Points in the pack mapping when the entry is stored
+/// raw, in buffer otherwise.
+struct AssetData {
+	const uint8*       data;
+	size_t             size;
+	std::vector<uint8> buffer;
+};
+
+
+/// Resolves asset names either from the asset pack, when one is mounted, or
+/// from the loose data directory.
+///
+/// Everything is thread-safe once mount() / setDataPath() are done, so
+/// workers can read assets directly.
+class AssetFs {
+public:
+	AssetFs();
+	AssetFs(const AssetFs&) = delete;
+
+	AssetFs& operator=(const AssetFs&) = delete;
+
+	const Path& dataPath() const;
+	void setDataPath(const Path& path);
+
+	bool mount(const Path& pack, std::string* error);
+	bool isPacked() const;
+
+	bool exists(const std::string& file) const;
+
+	/// Returns a stream on file, or null. The stream owns its data and must be
+	/// closed by the caller (or by a loader taking ownership, like
+	/// IMG_Load_RW(rw, 1)). Only the pack must outlive it.
+	SDL_RWops* open(const std::string& file) const;
+
+	bool read(const std::string& file, std::string* data) const;
+	/// Like read(), but without copying raw pack entries. data must not
+	/// outlive the pack.
+	bool read(const std::string& file, AssetData* data) const;
+
+protected:
+	Path      _dataPath;
+	AssetPack _pack;
+};
+
+
+#endif
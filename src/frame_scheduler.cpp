@@ -0,0 +1,120 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+
+#include "frame_scheduler.h"
+
+
+FrameScheduler::FrameScheduler()
+    : _frameDuration(0),
+      _startTime(0),
+      _nCosts(0),
+      _nextCost(0),
+      _predicted(0),
+      _safety(FRAME_SCHEDULER_MIN_SAFETY),
+      _nFrames(0),
+      _nMissed(0),
+      _worstLateness(0) {
+}
+
+
+void FrameScheduler::reset(uint64 frameDuration) {
+	_frameDuration = frameDuration;
+	_startTime     = 0;
+	_nCosts        = 0;
+	_nextCost      = 0;
+	// Until measured, keep the former fixed margin.
+	_predicted     = frameDuration / 2;
+	_safety        = FRAME_SCHEDULER_MIN_SAFETY;
+	_nFrames       = 0;
+	_nMissed       = 0;
+	_worstLateness = 0;
+}
+
+
+void FrameScheduler::frameStarted(uint64 time) {
+	_startTime = time;
+}
+
+
+void FrameScheduler::frameEnded(uint64 swapTime, uint64 gpuCost, uint64 presentTime,
+                                uint64 deadline) {
+	if(!_frameDuration || !_startTime) {
+		return;
+	}
+
+	_costs[_nextCost] = swapTime - _startTime + gpuCost;
+	_nextCost = (_nextCost + 1) % FRAME_SCHEDULER_HISTORY;
+	_nCosts   = std::min(_nCosts + 1, unsigned(FRAME_SCHEDULER_HISTORY));
+	++_nFrames;
+
+	if(presentTime > deadline) {
+		++_nMissed;
+		_worstLateness = std::max(_worstLateness, presentTime - deadline);
+		_safety = std::min(_safety * 3 / 2, _frameDuration / 2);
+	} else {
+		_safety = std::max(_safety - _safety / 64, FRAME_SCHEDULER_MIN_SAFETY);
+	}
+
+	predict();
+}
+
+
+uint64 FrameScheduler::margin() const {
+	return std::min(_predicted + _safety, _frameDuration);
+}
+
+
+uint64 FrameScheduler::predictedCost() const {
+	return _predicted;
+}
+
+
+unsigned FrameScheduler::nFrames() const {
+	return _nFrames;
+}
+
+
+unsigned FrameScheduler::nMissed() const {
+	return _nMissed;
+}
+
+
+void FrameScheduler::report(Logger& log) const {
+	if(!_frameDuration) {
+		return;
+	}
+
+	log.info("Frame scheduling: ", _nFrames, " frames, ", _nMissed, " missed deadlines (",
+	         _nFrames? 100.f * _nMissed / _nFrames: 0.f, "%), worst lateness ",
+	         _worstLateness / 1000000., " ms, margin ", margin() / 1000000.,
+	         " ms (predicted cpu + gpu cost ", _predicted / 1000000., " ms)");
+}
+
+
+void FrameScheduler::predict() {
+	uint64 costs[FRAME_SCHEDULER_HISTORY];
+	std::copy(_costs, _costs + _nCosts, costs);
+
+	unsigned index = unsigned(FRAME_SCHEDULER_PERCENTILE * (_nCosts - 1) + .5);
+	std::nth_element(costs, costs + index, costs + _nCosts);
+	_predicted = costs[index];
+}
@@ -0,0 +1,89 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_FRAME_SCHEDULER_H
+#define _AHIE_FRAME_SCHEDULER_H
+
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+
+
+#define FRAME_SCHEDULER_HISTORY    64
+#define FRAME_SCHEDULER_PERCENTILE .95
+#define FRAME_SCHEDULER_MIN_SAFETY uint64(500000)
+
+
+using namespace lair;
+
+
+/// Chooses how early each frame starts, so that it is built as late as
+/// possible (from the freshest ticks and input) and still presented on time.
+///
+/// The frame cost is the CPU time from the start of the frame to the call to
+/// swapBuffers, plus the GPU time of the draw calls: the return of
+/// swapBuffers would include the vsync wait, which a frame started later
+/// would not pay. The margin given to
+/// InterpLoop is a high percentile of the recent costs plus a safety margin.
+/// The safety margin grows quickly after a missed deadline and shrinks slowly
+/// while deadlines are met.
+class FrameScheduler {
+public:
+	FrameScheduler();
+
+	/// frameDuration 0 (unlocked frame rate) disables scheduling.
+	void reset(uint64 frameDuration);
+
+	void frameStarted(uint64 time);
+	/// swapTime is the call to swapBuffers and presentTime its return.
+	/// gpuCost is the latest GPU time of the draw calls, 0 if unknown.
+	/// deadline is the time the frame is meant to be displayed.
+	void frameEnded(uint64 swapTime, uint64 gpuCost, uint64 presentTime,
+	                uint64 deadline);
+
+	uint64 margin() const;
+	uint64 predictedCost() const;
+
+	unsigned nFrames() const;
+	unsigned nMissed() const;
+
+	void report(Logger& log) const;
+
+protected:
+	void predict();
+
+protected:
+	uint64   _frameDuration;
+	uint64   _startTime;
+
+	uint64   _costs[FRAME_SCHEDULER_HISTORY];
+	unsigned _nCosts;
+	unsigned _nextCost;
+
+	uint64   _predicted;
+	uint64   _safety;
+
+	unsigned _nFrames;
+	unsigned _nMissed;
+	uint64   _worstLateness;
+};
+
+
+#endif
@@ -0,0 +1,218 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "frame_stats.h"
+
+
+static const char* sectionNames[FrameStats::N_SECTIONS] = {
+    "ticks",
+    "uploads",
+    "build",
+    "draw",
+    "swap",
+};
+
+
+static double ms(uint64 ns) {
+	return ns / 1000000.;
+}
+
+
+FrameStats::FrameStats()
+    : _hitchThreshold(1000000000 / 30),
+      _lastPresent(0),
+      _firstStart(0),
+      _frames(),
+      _nextFrame(0),
+      _frameCount(0),
+      _hitches(),
+      _nextHitch(0),
+      _hitchCount(0) {
+	std::memset(&_current, 0, sizeof(_current));
+	_frames.reserve(FRAME_STATS_SIZE);
+	_hitches.reserve(FRAME_STATS_HITCHES);
+}
+
+
+void FrameStats::setHitchThreshold(uint64 threshold) {
+	_hitchThreshold = threshold;
+}
+
+
+uint64 FrameStats::hitchThreshold() const {
+	return _hitchThreshold;
+}
+
+
+void FrameStats::addTime(Section section, uint64 time) {
+	_current.sections[section] += time;
+}
+
+
+void FrameStats::setRenderCounts(unsigned drawCalls, unsigned vertices,
+                                 uint64 uploadBytes) {
+	_current.drawCalls   = drawCalls;
+	_current.vertices    = vertices;
+	_current.uploadBytes = uploadBytes;
+}
+
+
+void FrameStats::setGpuTime(uint64 time) {
+	_current.gpu = time;
+}
+
+
+void FrameStats::frameStarted(uint64 time) {
+	_current.start = time;
+	if(!_firstStart) {
+		_firstStart = time;
+	}
+}
+
+
+void FrameStats::frameEnded(uint64 time) {
+	_current.index    = _frameCount++;
+	_current.cpu      = time - _current.start - _current.sections[SWAP];
+	_current.interval = _lastPresent? time - _lastPresent: 0;
+	_lastPresent      = time;
+
+	// Fixed-size rings: no allocation once full.
+	if(_frames.size() < FRAME_STATS_SIZE) {
+		_frames.push_back(_current);
+	} else {
+		_frames[_nextFrame] = _current;
+	}
+	_nextFrame = (_nextFrame + 1) % FRAME_STATS_SIZE;
+
+	if(_current.interval > _hitchThreshold) {
+		if(_hitches.size() < FRAME_STATS_HITCHES) {
+			_hitches.push_back(_current);
+		} else {
+			_hitches[_nextHitch] = _current;
+		}
+		_nextHitch = (_nextHitch + 1) % FRAME_STATS_HITCHES;
+		++_hitchCount;
+	}
+
+	std::memset(&_current, 0, sizeof(_current));
+}
+
+
+unsigned FrameStats::nFrames() const {
+	return _frames.size();
+}
+
+
+/// Oldest first.
+const FrameStats::Frame& FrameStats::frame(unsigned i) const {
+	unsigned first = (_frames.size() < FRAME_STATS_SIZE)? 0: _nextFrame;
+	return _frames[(first + i) % _frames.size()];
+}
+
+
+const FrameStats::Frame& FrameStats::lastFrame() const {
+	return _frames[(_nextFrame + FRAME_STATS_SIZE - 1) % FRAME_STATS_SIZE];
+}
+
+
+uint64 FrameStats::nHitches() const {
+	return _hitchCount;
+}
+
+
+void FrameStats::report(Logger& log) const {
+	if(_frames.empty()) {
+		return;
+	}
+
+	// GPU times are missing from some frames.
+	auto sorted = [this](uint64 Frame::* field) {
+		std::vector<uint64> values;
+		values.reserve(_frames.size());
+		for(const Frame& frame: _frames) {
+			if(field != &Frame::gpu || frame.gpu) {
+				values.push_back(frame.*field);
+			}
+		}
+		std::sort(values.begin(), values.end());
+		return values;
+	};
+	auto at = [](const std::vector<uint64>& values, double q) {
+		return ms(values[size_t(q * (values.size() - 1) + .5)]);
+	};
+
+	log.info("Frame times over the last ", _frames.size(), " frames (ms): p50, p95, p99, max");
+	for(auto stat: { std::make_pair("interval", &Frame::interval),
+	                 std::make_pair("cpu",      &Frame::cpu),
+	                 std::make_pair("gpu",      &Frame::gpu) }) {
+		std::vector<uint64> values = sorted(stat.second);
+		if(values.empty()) {
+			continue;
+		}
+		log.info("  ", stat.first, ": ", at(values, .5), ", ", at(values, .95), ", ",
+		         at(values, .99), ", ", at(values, 1));
+	}
+
+	log.info(_hitchCount, " hitches above ", ms(_hitchThreshold), " ms in ", _frameCount, " frames");
+	std::vector<Frame> worst = _hitches;
+	std::sort(worst.begin(), worst.end(), [](const Frame& f0, const Frame& f1) {
+		return f0.interval > f1.interval;
+	});
+	worst.resize(std::min(worst.size(), size_t(FRAME_STATS_REPORTED_HITCHES)));
+	for(const Frame& hitch: worst) {
+		std::string sections;
+		for(int s = 0; s < N_SECTIONS; ++s) {
+			sections += std::string(s? ", ": "") + sectionNames[s] + " "
+			          + std::to_string(ms(hitch.sections[s]));
+		}
+		log.info("  frame ", hitch.index, ": ", ms(hitch.interval), " ms (", sections,
+		         "; ", hitch.drawCalls, " draw calls, ", hitch.uploadBytes >> 10, " KiB uploaded)");
+	}
+}
+
+
+bool FrameStats::exportCsv(const Path& file) const {
+	std::ofstream out(file.native());
+	if(!out) {
+		return false;
+	}
+
+	out << "frame,start_ms,interval_ms,cpu_ms,gpu_ms";
+	for(const char* name: sectionNames) {
+		out << "," << name << "_ms";
+	}
+	out << ",draw_calls,vertices,upload_bytes,hitch\n";
+
+	for(unsigned i = 0; i < nFrames(); ++i) {
+		const Frame& f = frame(i);
+		out << f.index << "," << ms(f.start - _firstStart) << "," << ms(f.interval)
+		    << "," << ms(f.cpu) << "," << ms(f.gpu);
+		for(uint64 section: f.sections) {
+			out << "," << ms(section);
+		}
+		out << "," << f.drawCalls << "," << f.vertices << "," << f.uploadBytes;
+		out << "," << (f.interval > _hitchThreshold) << "\n";
+	}
+	return bool(out);
+}
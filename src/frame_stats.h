@@ -0,0 +1,112 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_FRAME_STATS_H
+#define _AHIE_FRAME_STATS_H
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+
+
+#define FRAME_STATS_SIZE      4096
+#define FRAME_STATS_HITCHES   256
+#define FRAME_STATS_REPORTED_HITCHES 10
+#define FRAME_STATS_FILE      "frame_stats.csv"
+
+
+using namespace lair;
+
+
+/// Always-on frame timing capture.
+///
+/// The last FRAME_STATS_SIZE frames are kept in a ring buffer, with the time
+/// spent in each section of the frame. Frames whose interval exceeds the
+/// hitch threshold are also copied to a list of hitches, so that the cause of
+/// old hitches stays available. Nothing is logged while running: report()
+/// and exportCsv() are meant for the end of the session or a hotkey.
+class FrameStats {
+public:
+	enum Section {
+		TICKS,   // Ticks run since the previous frame.
+		UPLOADS, // Texture uploads.
+		BUILD,   // Layout and sprite batching.
+		DRAW,    // Draw calls.
+		SWAP,    // swapBuffers (waits for the GPU and vsync).
+		N_SECTIONS
+	};
+
+	struct Frame {
+		uint64 index;
+		uint64 start;
+		uint64 interval;  // Since the previous frame was presented.
+		uint64 cpu;       // Frame start to swapBuffers.
+		uint64 gpu;       // Draw calls of a previous frame, 0 if no result.
+		uint64 sections[N_SECTIONS];
+		unsigned drawCalls;
+		unsigned vertices;
+		uint64 uploadBytes;  // Vertices, indices and textures.
+	};
+
+public:
+	FrameStats();
+
+	void setHitchThreshold(uint64 threshold);
+	uint64 hitchThreshold() const;
+
+	void addTime(Section section, uint64 time);
+	void setRenderCounts(unsigned drawCalls, unsigned vertices, uint64 uploadBytes);
+	/// GPU timer results arrive a frame or two late: set the result read
+	/// during this frame, if any.
+	void setGpuTime(uint64 time);
+	void frameStarted(uint64 time);
+	/// time is the return of swapBuffers.
+	void frameEnded(uint64 time);
+
+	unsigned nFrames() const;
+	const Frame& frame(unsigned i) const;
+	/// The frame of the last call to frameEnded().
+	const Frame& lastFrame() const;
+	uint64 nHitches() const;
+
+	void report(Logger& log) const;
+	bool exportCsv(const Path& file) const;
+
+protected:
+	uint64   _hitchThreshold;
+
+	Frame    _current;
+	uint64   _lastPresent;
+	uint64   _firstStart;
+
+	std::vector<Frame> _frames;
+	unsigned _nextFrame;
+	uint64   _frameCount;
+
+	std::vector<Frame> _hitches;
+	unsigned _nextHitch;
+	uint64   _hitchCount;
+};
+
+
+#endif
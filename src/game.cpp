@@ -20,10 +20,12 @@
 
 #include <iostream>
 #include <functional>
+#include <thread>
 
 #include <SDL_mixer.h>
 
 #include "main_state.h"
+#include "trace.h"
 
 #include "game.h"
 
@@ -40,15 +42,22 @@ Game::Game(int argc, char** argv)
       _fileBackend(_logStream, false),
       _logger("game", &_mlogger, DEFAULT_LOG_LEVEL),
 
+      _startup(),
+
       _dataPath(),
+      _assets(nullptr),
+
+      _tasks(nullptr),
 
       _sys(nullptr),
       _window(nullptr),
 
       _renderModule(nullptr),
       _renderer(nullptr),
+      _textures(nullptr),
 
       _audio(nullptr),
+      _music(nullptr),
 
       _nextState(nullptr),
       _currentState(nullptr),
@@ -74,6 +83,16 @@ Path Game::dataPath() const {
 }
 
 
+AssetFs* Game::assets() {
+	return _assets.get();
+}
+
+
+TaskPool* Game::tasks() {
+	return _tasks.get();
+}
+
+
 SysModule* Game::sys() {
 	return _sys.get();
 }
@@ -94,16 +113,41 @@ Renderer* Game::renderer() {
 }
 
 
+TextureManager* Game::textures() {
+	return _textures.get();
+}
+
+
 SoundPlayer* Game::audio() {
 	return _audio.get();
 }
 
 
+StartupReport* Game::startup() {
+	return &_startup;
+}
+
+
 void Game::initialize() {
+	if(const char* trace = std::getenv("AHIE_TRACE")) {
+		Tracer::instance().setEnabled(std::atoi(trace) != 0);
+	}
+	TRACE_THREAD_NAME("main");
+	TRACE_SCOPE("Game::initialize");
+
 	log().log("Starting game...");
 
+	uint64 time = Tracer::now();
+	// Closes the current phase.
+	auto phase = [this, &time](const char* name) {
+		uint64 now = Tracer::now();
+		_startup.addPhase(name, time, now);
+		time = now;
+	};
+
 	_sys.reset(new SysModule(&_mlogger, LogLevel::Log));
 	_sys->initialize();
+	phase("sdl init");
 	_sys->onQuit = std::bind(&Game::quit, this);
 
 	const char* envPath = std::getenv("LOF3_DATA_DIR");
@@ -114,42 +158,140 @@ void Game::initialize() {
 	}
 	log().log("Data directory: ", _dataPath);
 
+	// A pack replaces the data directory entirely. Setting LOF3_DATA_DIR
+	// alone still loads loose files, which is handy while editing assets.
+	_assets.reset(new AssetFs);
+	_assets->setDataPath(_dataPath);
+	const char* envPack = std::getenv("AHIE_ASSET_PACK");
+	if(envPack || !envPath) {
+		Path packPath = envPack? Path(envPack): _sys->basePath() / ASSET_PACK_FILE;
+		std::string error;
+		if(_assets->mount(packPath, &error)) {
+			log().log("Asset pack: ", packPath);
+		} else if(envPack) {
+			log().error("Failed to open asset pack ", packPath, ": ", error);
+		}
+	}
+	phase("asset pack");
+
 	_sys->loader().setNThread(1);
 	_sys->loader().setBasePath(dataPath());
 
+	// Asset decoding. Keep a core for the main thread.
+	unsigned nThreads = std::thread::hardware_concurrency();
+	_tasks.reset(new TaskPool);
+	_tasks->start((nThreads > 1)? nThreads - 1: 1);
+	log().info("Loader threads: ", _tasks->nThreads());
+	phase("task pool");
+
+	// Sounds are decoded on several workers at once, and SDL_mixer loads and
+	// opens its codecs on first use without any locking. Opening them here,
+	// on the main thread and before any decode is queued, leaves the workers
+	// with codecs that are already initialized.
 	SDL_InitSubSystem(SDL_INIT_AUDIO);
-	Mix_Init(MIX_INIT_OGG);
+	if(!(Mix_Init(MIX_INIT_OGG) & MIX_INIT_OGG)) {
+		log().error("Failed to initialize the OGG decoder: ", Mix_GetError());
+	}
+	phase("audio init");
+
+	// Float samples let sound effects go through our own mixer. A small
+	// AHIE_AUDIO_FRAMES (128 or 256) selects the low-latency mode.
+	const char* framesEnv = std::getenv("AHIE_AUDIO_FRAMES");
+	int frames = framesEnv? std::atoi(framesEnv): 0;
+	if(frames <= 0) {
+		frames = 1024;
+	}
 
 	log().log("Initialize SDL_mixer...");
-	if(Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, MIX_DEFAULT_CHANNELS, 1024)) {
+	if(Mix_OpenAudio(44100, AUDIO_F32SYS, MIX_DEFAULT_CHANNELS, frames)) {
 		log().error("Failed to initialize SDL_mixer backend");
 	}
 	Mix_AllocateChannels(SOUNDPLAYER_MAX_CHANNELS);
+	phase("mixer open");
 
 	_window = _sys->createWindow("Alice had it easy", 1280, 720);
 	//_window->setFullscreen(true);
 	//_sys->setVSyncEnabled(false);
 	log().info("VSync: ", _sys->isVSyncEnabled()? "on": "off");
+	phase("window and gl context");
 
 	_renderModule.reset(new RenderModule(sys(), &_mlogger, DEFAULT_LOG_LEVEL));
 	_renderModule->initialize();
 	_renderer = _renderModule->createRenderer();
+	phase("renderer");
+
+	_textures.reset(new TextureManager(this));
+	const char* budget = std::getenv("AHIE_TEXTURE_BUDGET");
+	if(budget) {
+		_textures->setBudget(size_t(std::atoi(budget)) << 20);
+	}
+	_textures->setViewScale(float(std::min(_window->width(), _window->height()))
+	                        / TEXTURE_REFERENCE_HEIGHT);
+	log().info("Texture budget: ", _textures->budget() >> 20, " MiB");
+
+	// An empty AHIE_TEXTURE_CACHE disables the cache.
+	const char* cacheDir = std::getenv("AHIE_TEXTURE_CACHE");
+	if(!cacheDir || *cacheDir) {
+		Path cachePath = cacheDir? Path(cacheDir): _sys->basePath() / TEXTURE_CACHE_DIR;
+		if(_textures->cache()->setDirectory(cachePath)) {
+			const char* cacheSize = std::getenv("AHIE_TEXTURE_CACHE_SIZE");
+			if(cacheSize) {
+				_textures->cache()->setMaxSize(size_t(std::atoi(cacheSize)) << 20);
+			}
+			log().info("Texture cache: ", cachePath, " (",
+			           _textures->cache()->maxSize() >> 20, " MiB)");
+
+			// Drops the entries of old or modified assets, off the main thread.
+			TextureCache* cache = _textures->cache();
+			_tasks->enqueue([cache] { cache->prune(); });
+		} else {
+			log().warning("Cannot use texture cache directory ", cachePath);
+		}
+	}
+
+	phase("texture manager");
 
 	_audio.reset(new SoundPlayer(this));
 	_audio->setMusicVolume(.2);
-	_music = _audio->loadMusic(dataPath() / "alice_hie.ogg");
-	_audio->playMusic(_music);
+	_audio->enableMixer();
+	const char* soundBudget = std::getenv("AHIE_SOUND_BUDGET");
+	if(soundBudget) {
+		_audio->setPcmBudget(size_t(std::atoi(soundBudget)) << 20);
+	}
 
+	phase("sound player");
+
+	// Staged boot: the title is requested first so that it is decoded
+	// first, everything else streams in behind it while it is displayed.
 	_screenState.reset(new ScreenState(this));
 	_screenState->initialize();
+	phase("ScreenState::initialize");
 
 	_mainState.reset(new MainState(this));
 	_mainState->initialize();
+	phase("MainState::initialize");
+
+	// Starts playing once decoded.
+	_music = _audio->loadMusicAsync("alice_hie.ogg");
+	_audio->playMusic(_music);
+	phase("music");
 }
 
 
 void Game::shutdown() {
-	_audio->releaseMusic(_music);
+	// Quit before the end of the loading.
+	writeStartupReport();
+	if(Tracer::instance().isEnabled()) {
+		writeTrace();
+	}
+
+	// Loader tasks capture the states, the texture manager and the sound
+	// player: stop them before anything is destroyed.
+	_tasks->stop();
+
+	if(_music) {
+		_audio->releaseMusic(_music);
+	}
 
 	_mainState->shutdown();
 	_mainState.reset();
@@ -157,6 +299,8 @@ void Game::shutdown() {
 	_screenState->shutdown();
 	_screenState.reset();
 
+	_textures.reset();
+
 	_renderModule->shutdown();
 	_renderModule.reset();
 
@@ -165,6 +309,36 @@ void Game::shutdown() {
 	_window->destroy();
 	_sys->shutdown();
 	_sys.reset();
+
+	_tasks.reset();
+}
+
+
+void Game::updateAssets(unsigned maxUploads) {
+	_tasks->runMainThreadTasks();
+	_textures->update(maxUploads);
+	_audio->update();
+}
+
+
+void Game::writeTrace() {
+	if(Tracer::instance().exportJson(TRACE_FILE)) {
+		log().info("Trace written to ", TRACE_FILE);
+	} else {
+		log().warning("Failed to write ", TRACE_FILE);
+	}
+}
+
+
+void Game::writeStartupReport() {
+	if(!_startup.isRecording()) {
+		return;
+	}
+	if(_startup.write(STARTUP_REPORT_FILE)) {
+		log().info("Startup report written to ", STARTUP_REPORT_FILE);
+	} else {
+		log().warning("Failed to write ", STARTUP_REPORT_FILE);
+	}
 }
 
 
@@ -180,6 +354,7 @@ void Game::run() {
 	while(_nextState) {
 		_currentState = _nextState;
 		_nextState    = nullptr;
+		TRACE_SCOPE((_currentState == _mainState.get())? "MainState::run": "ScreenState::run");
 		_currentState->run();
 	}
 }
@@ -35,6 +35,10 @@
 #include <lair/render_gl2/renderer.h>
 
 #include "sound_player.h"
+#include "asset_pack.h"
+#include "task_pool.h"
+#include "startup_report.h"
+#include "texture_manager.h"
 #include "main_state.h"
 
 #include "screen_state.h"
@@ -50,18 +54,29 @@ public:
 	~Game();
 
 	Path dataPath() const;
+	AssetFs*      assets();
+
+	TaskPool*     tasks();
 
 	SysModule*    sys();
 	Window*       window();
 
 	RenderModule* renderModule();
 	Renderer*     renderer();
+	TextureManager* textures();
 
 	SoundPlayer*  audio();
+	StartupReport* startup();
 
 	void initialize();
 	void shutdown();
 
+	void updateAssets(unsigned maxUploads);
+	/// Writes the events recorded so far to TRACE_FILE.
+	void writeTrace();
+	/// Writes STARTUP_REPORT_FILE, once.
+	void writeStartupReport();
+
 	void setNextState(GameState* state);
 	void run();
 	void quit();
@@ -81,7 +96,14 @@ protected:
 	OStreamLogger _fileBackend;
 	Logger        _logger;
 
+	StartupReport _startup;
+
 	Path          _dataPath;
+	std::unique_ptr<AssetFs>
+	              _assets;
+
+	std::unique_ptr<TaskPool>
+	              _tasks;
 
 	std::unique_ptr<SysModule>
 	              _sys;
@@ -90,6 +112,8 @@ protected:
 	std::unique_ptr<RenderModule>
 	              _renderModule;
 	Renderer*     _renderer;
+	std::unique_ptr<TextureManager>
+	              _textures;
 
 	std::unique_ptr<SoundPlayer>
 	              _audio;
@@ -0,0 +1,125 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstring>
+
+#include <SDL_video.h>
+
+#include "gpu_timer.h"
+
+
+GpuTimer::GpuTimer()
+    : _enabled(false),
+      _next(0),
+      _oldest(0),
+      _running(false),
+      _lastTime(0) {
+	std::memset(_queries, 0, sizeof(_queries));
+	std::memset(_pending, 0, sizeof(_pending));
+}
+
+
+GpuTimer::~GpuTimer() {
+	shutdown();
+}
+
+
+void GpuTimer::initialize(Logger& log) {
+#ifdef GL_TIME_ELAPSED
+	int major = 0;
+	int minor = 0;
+	SDL_GL_GetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, &major);
+	SDL_GL_GetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, &minor);
+	_enabled = (major > 3 || (major == 3 && minor >= 3))
+	        || SDL_GL_ExtensionSupported("GL_ARB_timer_query");
+#endif
+	if(_enabled) {
+		glGenQueries(GPU_TIMER_QUERIES, _queries);
+	} else {
+		log.warning("No GL timer queries, GPU times disabled");
+	}
+}
+
+
+void GpuTimer::shutdown() {
+	if(_enabled) {
+		glDeleteQueries(GPU_TIMER_QUERIES, _queries);
+		std::memset(_queries, 0, sizeof(_queries));
+		std::memset(_pending, 0, sizeof(_pending));
+		_enabled = false;
+	}
+}
+
+
+bool GpuTimer::isEnabled() const {
+	return _enabled;
+}
+
+
+void GpuTimer::begin() {
+#ifdef GL_TIME_ELAPSED
+	// All the queries are still in flight: skip rather than wait.
+	if(!_enabled || _running || _pending[_next]) {
+		return;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, _queries[_next]);
+	_running = true;
+#endif
+}
+
+
+void GpuTimer::end() {
+#ifdef GL_TIME_ELAPSED
+	if(!_running) {
+		return;
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	_pending[_next] = true;
+	_next    = (_next + 1) % GPU_TIMER_QUERIES;
+	_running = false;
+#endif
+}
+
+
+bool GpuTimer::collect() {
+	bool updated = false;
+#ifdef GL_TIME_ELAPSED
+	// Results arrive in order.
+	while(_pending[_oldest]) {
+		GLint available = 0;
+		glGetQueryObjectiv(_queries[_oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+		if(!available) {
+			break;
+		}
+		GLuint64 time = 0;
+		glGetQueryObjectui64v(_queries[_oldest], GL_QUERY_RESULT, &time);
+		_lastTime = time;
+		_pending[_oldest] = false;
+		_oldest  = (_oldest + 1) % GPU_TIMER_QUERIES;
+		updated  = true;
+	}
+#endif
+	return updated;
+}
+
+
+uint64 GpuTimer::lastTime() const {
+	return _lastTime;
+}
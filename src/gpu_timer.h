@@ -0,0 +1,75 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef _AHIE_GPU_TIMER_H
+#define _AHIE_GPU_TIMER_H
+
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+
+#include <lair/render_gl2/renderer.h>
+
+
+#define GPU_TIMER_QUERIES 4
+
+
+using namespace lair;
+
+
+/// GPU time of a part of each frame, from GL_TIME_ELAPSED queries.
+///
+/// Queries are used round-robin and their results are only read once
+/// available, so the timer never waits for the GPU: results arrive one or two
+/// frames late, and a frame is simply not measured if all the queries are
+/// still busy.
+class GpuTimer {
+public:
+	GpuTimer();
+	GpuTimer(const GpuTimer&) = delete;
+	~GpuTimer();
+
+	GpuTimer& operator=(const GpuTimer&) = delete;
+
+	/// Needs the GL context. The timer is disabled without timer queries.
+	void initialize(Logger& log);
+	void shutdown();
+	bool isEnabled() const;
+
+	void begin();
+	void end();
+
+	/// Reads the results that are ready, without waiting. Returns true if
+	/// lastTime() changed.
+	bool collect();
+	/// GPU time of the last measured frame, 0 if none.
+	uint64 lastTime() const;
+
+protected:
+	bool     _enabled;
+	GLuint   _queries[GPU_TIMER_QUERIES];
+	bool     _pending[GPU_TIMER_QUERIES];
+	unsigned _next;     // Next query to begin.
+	unsigned _oldest;   // Oldest pending query.
+	bool     _running;
+	uint64   _lastTime;
+};
+
+
+#endif
@@ -0,0 +1,92 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "key_event_queue.h"
+
+
+KeyEventQueue::KeyEventQueue(SysModule* sys)
+    : _sys(sys),
+      _enabled(false),
+      _keys(),
+      _mutex(),
+      _events() {
+}
+
+
+KeyEventQueue::~KeyEventQueue() {
+	disable();
+}
+
+
+void KeyEventQueue::watchKey(SDL_Scancode key, unsigned id) {
+	_keys.push_back(Key{ key, id });
+}
+
+
+void KeyEventQueue::enable() {
+	if(!_enabled) {
+		SDL_AddEventWatch(&KeyEventQueue::eventWatch, this);
+		_enabled = true;
+	}
+}
+
+
+void KeyEventQueue::disable() {
+	if(_enabled) {
+		SDL_DelEventWatch(&KeyEventQueue::eventWatch, this);
+		_enabled = false;
+	}
+}
+
+
+void KeyEventQueue::pop(uint64 time, EventList* events) {
+	events->clear();
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	while(!_events.empty() && _events.front().time <= time) {
+		events->push_back(_events.front());
+		_events.pop_front();
+	}
+}
+
+
+void KeyEventQueue::clear() {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_events.clear();
+}
+
+
+// Called by SDL when an event is queued.
+int KeyEventQueue::eventWatch(void* queue, SDL_Event* event) {
+	KeyEventQueue* self = static_cast<KeyEventQueue*>(queue);
+	if(event->type != SDL_KEYDOWN || event->key.repeat) {
+		return 1;
+	}
+
+	for(const Key& key: self->_keys) {
+		if(key.scancode == event->key.keysym.scancode) {
+			uint64 time = self->_sys->getTimeNs();
+			std::lock_guard<std::mutex> lock(self->_mutex);
+			self->_events.push_back(Event{ key.id, time });
+			break;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,91 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_KEY_EVENT_QUEUE_H
+#define _AHIE_KEY_EVENT_QUEUE_H
+
+
+#include <deque>
+#include <vector>
+#include <mutex>
+
+#include <SDL_events.h>
+
+#include <lair/core/lair.h>
+#include <lair/sys_sdl2/sys_module.h>
+
+
+using namespace lair;
+
+
+/// Timestamped key presses.
+///
+/// InputManager only samples the keyboard state once per tick, so presses
+/// within a tick are merged and their time is lost. This queue records each
+/// press of the watched keys when SDL queues it (event watch), with the
+/// SysModule clock, so that the simulation can consume them tick by tick in
+/// order and with their real time.
+class KeyEventQueue {
+public:
+	struct Event {
+		unsigned id;   // As given to watchKey().
+		uint64   time;
+	};
+
+	typedef std::vector<Event> EventList;
+
+public:
+	KeyEventQueue(SysModule* sys);
+	KeyEventQueue(const KeyEventQueue&) = delete;
+	~KeyEventQueue();
+
+	KeyEventQueue& operator=(const KeyEventQueue&) = delete;
+
+	/// Keys must be set before enable().
+	void watchKey(SDL_Scancode key, unsigned id);
+
+	void enable();
+	void disable();
+
+	/// Moves the presses up to time to events, oldest first.
+	void pop(uint64 time, EventList* events);
+	void clear();
+
+protected:
+	struct Key {
+		SDL_Scancode scancode;
+		unsigned     id;
+	};
+
+protected:
+	static int eventWatch(void* queue, SDL_Event* event);
+
+protected:
+	SysModule*        _sys;
+	bool              _enabled;
+	std::vector<Key>  _keys;
+
+	// SDL may call the event watch from another thread on some platforms.
+	std::mutex        _mutex;
+	std::deque<Event> _events;
+};
+
+
+#endif
@@ -0,0 +1,160 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+
+#include "sound_player.h"
+
+#include "latency_probe.h"
+
+
+static const char* stageNames[LatencyProbe::N_STAGES] = {
+    "key -> tick",
+    "key -> action",
+    "action -> present",
+    "action -> audio",
+    "key -> present",
+    "key -> audio",
+};
+
+
+LatencyProbe::LatencyProbe(SysModule* sys)
+    : _sys(sys),
+      _enabled(false),
+      _keyTime(0),
+      _actionTime(0),
+      _presentTime(0),
+      _channel(-1) {
+}
+
+
+LatencyProbe::~LatencyProbe() {
+	disable();
+}
+
+
+void LatencyProbe::enable() {
+	if(!_enabled) {
+		for(std::vector<uint64>& samples: _samples) {
+			samples.reserve(LATENCY_PROBE_MAX_SAMPLES);
+		}
+		_enabled = true;
+	}
+}
+
+
+void LatencyProbe::disable() {
+	_enabled = false;
+}
+
+
+bool LatencyProbe::isEnabled() const {
+	return _enabled;
+}
+
+
+void LatencyProbe::inputSeen(uint64 keyTime) {
+	if(!_enabled) {
+		return;
+	}
+
+	if(_actionTime) {
+		// The previous action is still waiting for its frame or its sound.
+		reset();
+	}
+	_keyTime = keyTime;
+	record(KEY_TO_TICK, _keyTime, _sys->getTimeNs());
+}
+
+
+void LatencyProbe::action(int channel) {
+	if(!_enabled || !_keyTime || _actionTime) {
+		return;
+	}
+
+	_actionTime = _sys->getTimeNs();
+	_channel    = channel;
+	record(KEY_TO_ACTION, _keyTime, _actionTime);
+}
+
+
+void LatencyProbe::framePresented(const SoundPlayer* audio) {
+	if(!_enabled || !_actionTime) {
+		return;
+	}
+
+	uint64 now = _sys->getTimeNs();
+	if(!_presentTime) {
+		_presentTime = now;
+		record(ACTION_TO_PRESENT, _actionTime, _presentTime);
+		record(KEY_TO_PRESENT,    _keyTime,    _presentTime);
+	}
+
+	uint64 audioTime;
+	if(_channel >= 0 && audio->soundStartTime(_channel, &audioTime)) {
+		record(ACTION_TO_AUDIO, _actionTime, audioTime);
+		record(KEY_TO_AUDIO,    _keyTime,    audioTime);
+		reset();
+	} else if(_channel < 0 || now - _actionTime > LATENCY_PROBE_AUDIO_TIMEOUT) {
+		// No sound, or no timing from the SDL_mixer fallback.
+		reset();
+	}
+}
+
+
+void LatencyProbe::report(Logger& log) const {
+	if(!_enabled) {
+		return;
+	}
+
+	log.info("Input latency (ms): count, min, median, 90%, 99%, max");
+	for(int stage = 0; stage < N_STAGES; ++stage) {
+		std::vector<uint64> samples = _samples[stage];
+		if(samples.empty()) {
+			log.info("  ", stageNames[stage], ": no samples");
+			continue;
+		}
+
+		std::sort(samples.begin(), samples.end());
+		auto ms = [&samples](double q) {
+			return samples[size_t(q * (samples.size() - 1) + .5)] / 1000000.;
+		};
+		log.info("  ", stageNames[stage], ": ", samples.size(),
+		         ", ", ms(0), ", ", ms(.5), ", ", ms(.9), ", ", ms(.99), ", ", ms(1));
+	}
+}
+
+
+void LatencyProbe::record(Stage stage, uint64 from, uint64 to) {
+	std::vector<uint64>& samples = _samples[stage];
+	if(samples.size() < LATENCY_PROBE_MAX_SAMPLES) {
+		// Sounds are scheduled at the tick time, which may be earlier than
+		// the action during catch-up; count it as 0.
+		samples.push_back(to > from? to - from: 0);
+	}
+}
+
+
+void LatencyProbe::reset() {
+	_keyTime     = 0;
+	_actionTime  = 0;
+	_presentTime = 0;
+	_channel     = -1;
+}
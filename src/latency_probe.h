@@ -0,0 +1,100 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_LATENCY_PROBE_H
+#define _AHIE_LATENCY_PROBE_H
+
+
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/sys_sdl2/sys_module.h>
+
+
+#define LATENCY_PROBE_MAX_SAMPLES 4096
+#define LATENCY_PROBE_AUDIO_TIMEOUT 1000000000ull
+
+
+using namespace lair;
+
+
+class SoundPlayer;
+
+
+/// Measures the latency from a key press to its effects.
+///
+/// The game reports the tick that sees a press, with the time KeyEventQueue
+/// gave it (inputSeen()), the tick that changes the sprites and starts a sound
+/// (action()) and the end of each frame (framePresented()). The start of the
+/// sound is the time the mixer callback reaches its first sample. All times
+/// use the SysModule clock.
+///
+/// Only one press is followed at a time: a press seen before the action
+/// replaces the previous one (double taps).
+class LatencyProbe {
+public:
+	enum Stage {
+		KEY_TO_TICK,
+		KEY_TO_ACTION,
+		ACTION_TO_PRESENT,
+		ACTION_TO_AUDIO,
+		KEY_TO_PRESENT,
+		KEY_TO_AUDIO,
+		N_STAGES
+	};
+
+public:
+	LatencyProbe(SysModule* sys);
+	LatencyProbe(const LatencyProbe&) = delete;
+	~LatencyProbe();
+
+	LatencyProbe& operator=(const LatencyProbe&) = delete;
+
+	void enable();
+	void disable();
+	bool isEnabled() const;
+
+	/// keyTime is the time of the press, from KeyEventQueue.
+	void inputSeen(uint64 keyTime);
+	/// channel is the one returned by SoundPlayer::playSound(), or -1.
+	void action(int channel);
+	void framePresented(const SoundPlayer* audio);
+
+	void report(Logger& log) const;
+
+protected:
+	void record(Stage stage, uint64 from, uint64 to);
+	void reset();
+
+protected:
+	SysModule*                _sys;
+	bool                      _enabled;
+
+	uint64                    _keyTime;
+	uint64                    _actionTime;
+	uint64                    _presentTime;
+	int                       _channel;
+
+	std::vector<uint64>       _samples[N_STAGES];
+};
+
+
+#endif
@@ -18,11 +18,14 @@
 //
 
 
+#include <cstdlib>
 #include <functional>
+#include <sstream>
 
 #include "font.h"
 #include "menu.h"
 #include "game.h"
+#include "trace.h"
 
 #include "main_state.h"
 
@@ -45,8 +48,14 @@ MainState::MainState(Game* game)
       _initialized(false),
       _running(false),
       _loop(_game->sys()),
-      _fpsTime(0),
-      _fpsCount(0),
+      _frameStats(),
+      _renderStats(_game->textures()),
+      _latency(_game->sys()),
+      _scheduler(),
+      _gpuTimer(),
+#ifdef AHIE_PROFILER
+      _profiler(_game->sys()),
+#endif
 
       _fontTex(nullptr),
       _fontJson(),
@@ -55,9 +64,25 @@ MainState::MainState(Game* game)
 	  _drinkInput(nullptr),
 	  _eatInput(nullptr),
 	  _debugInput(nullptr),
+	  _fastForwardInput(nullptr),
+	  _statsInput(nullptr),
+#ifdef AHIE_PROFILER
+	  _profilerInput(nullptr),
+#endif
+	  _traceInput(nullptr),
+	  _timeScale(1),
+	  _batchSounds(),
+      _keyEvents(_game->sys()),
+      _tickEvents(),
 
       _bgSprite(),
 
+      _characterViews(nullptr),
+      _foodsViews(nullptr),
+
+      _deathTextures(),
+      _deathAssetsRequested(false),
+
 	  _bg() {
 }
 
@@ -67,18 +92,156 @@ MainState::~MainState() {
 
 
 Sprite MainState::loadSprite(const char* file, unsigned th, unsigned tv,
-                             unsigned flags) {
-	Texture* tex = _game->renderer()->getTexture(
-				file, flags);
+                             unsigned flags, float displayScale) {
+	TRACE_SCOPE_DETAIL("loadSprite", file);
+	Texture* tex = _game->textures()->get(
+				file, flags, displayScale);
+	_game->textures()->prefetch(file, flags, displayScale);
+	whenResident(tex, Callback());
+	_trim.bind(tex, file);
 	return Sprite(tex, th, tv);
 }
 
 
+Sprite MainState::lazySprite(const char* file, float displayScale) {
+	Texture* tex = _game->textures()->get(
+				file, Texture::BILINEAR | Texture::CLAMP, displayScale);
+	_trim.bind(tex, file);
+	_deathTextures.push_back(file);
+	return Sprite(tex);
+}
+
+
+void MainState::loadJson(const char* file, const JsonCallback& callback) {
+	_loading.add();
+
+	std::string name = file;
+	_game->tasks()->enqueue([this, name, callback] {
+		Json::Value json;
+		std::string error;
+		std::string data;
+		StartupReport* startup = _game->startup();
+		uint64 start = Tracer::now();
+		if(_game->assets()->read(name, &data)) {
+			uint64 parseStart = Tracer::now();
+			startup->addAssetStep(name, "json", StartupReport::IO, start, parseStart, data.size());
+
+			TRACE_SCOPE_DETAIL("parseJson", name.c_str());
+			std::istringstream jsonFile(data);
+			try {
+				jsonFile >> json;
+			} catch(std::exception& e) {
+				error = e.what();
+			}
+			startup->addAssetStep(name, nullptr, StartupReport::DECODE,
+			                      parseStart, Tracer::now());
+		} else {
+			error = "file not found";
+		}
+
+		_game->tasks()->post([this, name, json, error, callback] {
+			if(!error.empty()) {
+				log().error("Error while parsing \"", name, "\": ", error);
+			}
+			callback(json);
+			_loading.done();
+		});
+	});
+}
+
+
+// Loads the font description, then its texture, then builds the font.
+void MainState::loadFont(const char* file, Texture** tex, Json::Value* json,
+                         std::unique_ptr<Font>* font, unsigned baselineToTop,
+                         const char* statsName) {
+	std::string name = file;
+	loadJson(file, [this, name, tex, json, font, baselineToTop, statsName]
+	               (const Json::Value& value) {
+		*json = value;
+		*tex  = _game->textures()->get((*json)["file"].asString(),
+		        Texture::NEAREST | Texture::REPEAT);
+		_game->textures()->prefetch((*json)["file"].asString(),
+		        Texture::NEAREST | Texture::REPEAT);
+		whenResident(*tex, [this, name, tex, json, font, baselineToTop, statsName] {
+			// Its own entry, the json keeps its parse time.
+			uint64 start = Tracer::now();
+			font->reset(new Font(*json, *tex));
+			_game->startup()->addAssetStep(name + " (font)", "font",
+			                               StartupReport::DECODE, start, Tracer::now());
+			(*font)->baselineToTop = baselineToTop;
+			_renderStats.addSource(*tex, statsName);
+		});
+	});
+}
+
+
+void MainState::whenResident(Texture* tex, const Callback& callback) {
+	_loading.add();
+	_pendingTextures.push_back(PendingTexture{ tex, callback });
+}
+
+
+// Expects the caller to pump Game::updateAssets.
+bool MainState::updateLoading() {
+	if(_initialized) {
+		return true;
+	}
+
+	std::vector<Callback> ready;
+	for(unsigned i = 0; i < _pendingTextures.size(); ) {
+		PendingTexture& pending = _pendingTextures[i];
+		if(_game->textures()->state(pending.texture) != TextureManager::LOADING) {
+			// Resident, or failed to load, which has already been reported.
+			if(pending.callback) {
+				ready.push_back(pending.callback);
+			}
+			_pendingTextures[i] = _pendingTextures.back();
+			_pendingTextures.pop_back();
+			_loading.done();
+		} else {
+			++i;
+		}
+	}
+	for(const Callback& callback: ready) {
+		callback();
+	}
+
+	if(_loading.isDone()) {
+		createEntities();
+		_game->startup()->addMilestone("main state ready");
+		_game->writeStartupReport();
+	}
+
+	return _initialized;
+}
+
+
+const LoadProgress& MainState::loadingProgress() const {
+	return _loading;
+}
+
+
 void MainState::initialize() {
+	TRACE_SCOPE("MainState::initialize");
+
+	// Frames are interpolated between ticks, so the frame rate is free.
+	uint64 frameDuration = 1000000000 / 60;
+	if(const char* fps = std::getenv("AHIE_FPS")) {
+		int rate = std::atoi(fps);
+		frameDuration = (rate > 0)? 1000000000 / rate: 0;
+	}
+
 	_loop.reset();
-	_loop.setTickDuration(    1000000000 /  60);
-	_loop.setFrameDuration(   1000000000 /  60);
-	_loop.setMaxFrameDuration(_loop.frameDuration() * 3);
+	// Lower tick rates (e.g. 10 or 20 Hz) give the same game, see
+	// integrateEffects().
+	int tickRate = 60;
+	if(const char* rate = std::getenv("AHIE_TICK_RATE")) {
+		tickRate = std::max(1, std::min(std::atoi(rate), 1000));
+	}
+
+	_loop.setTickDuration(    1000000000 / tickRate);
+	_loop.setFrameDuration(   frameDuration);
+	_loop.setMaxFrameDuration(std::max(_loop.frameDuration(), _loop.tickDuration()) * 3);
 	_loop.setFrameMargin(     _loop.frameDuration() / 2);
 
 	_game->window()->onResize.connect(std::bind(&MainState::layoutScreen, this))
@@ -92,21 +255,50 @@ void MainState::initialize() {
 	_inputs.mapScanCode(_drinkInput, SDL_SCANCODE_RIGHT);
 	_inputs.mapScanCode(_eatInput,   SDL_SCANCODE_LEFT);
 
+	_keyEvents.watchKey(SDL_SCANCODE_RIGHT, DRINK);
+	_keyEvents.watchKey(SDL_SCANCODE_LEFT,  FOOD);
+	_keyEvents.enable();
+
+	_statsInput = _inputs.addInput("frame_stats");
+	_inputs.mapScanCode(_statsInput, SDL_SCANCODE_F3);
+
+	_traceInput = _inputs.addInput("trace");
+	_inputs.mapScanCode(_traceInput, SDL_SCANCODE_F4);
+
+	_gpuTimer.initialize(log());
+
+#ifdef AHIE_PROFILER
+	_profilerInput = _inputs.addInput("profiler");
+	_inputs.mapScanCode(_profilerInput, SDL_SCANCODE_F2);
+#endif
+
+	_fastForwardInput = _inputs.addInput("fast_forward");
+	_inputs.mapScanCode(_fastForwardInput, SDL_SCANCODE_TAB);
+
+	if(const char* scale = std::getenv("AHIE_TIME_SCALE")) {
+		_timeScale = std::max(1, std::min(std::atoi(scale), MAX_TIME_SCALE));
+	}
+
 	//TODO: Remove cheats.
 	_debugInput = _inputs.addInput("debug");
 	_inputs.mapScanCode(_debugInput, SDL_SCANCODE_F1);
 
-	_fontJson = _game->sys()->loader().getJson("8-bit_operator+_regular_23.json");
-	_fontTex  = _game->renderer()->getTexture(_fontJson["file"].asString(),
-	        Texture::NEAREST | Texture::REPEAT);
-	_font.reset(new Font(_fontJson, _fontTex));
-	_font->baselineToTop = 12;
+	if(std::getenv("AHIE_LATENCY_PROBE")) {
+		_latency.enable();
+	}
+
+	// Declare all the assets up front. They are decoded by the task pool,
+	// updateLoading() finishes the initialization once they are ready.
+	_loading.reset();
+
+	loadFont("8-bit_operator+_regular_23.json", &_fontTex, &_fontJson, &_font,
+	         12, "font");
+	loadFont("please.json", &_font2Tex, &_font2Json, &_font2,
+	         56, "title font");
 
-	_font2Json = _game->sys()->loader().getJson("please.json");
-	_font2Tex  = _game->renderer()->getTexture(_font2Json["file"].asString(),
-	        Texture::NEAREST | Texture::REPEAT);
-	_font2.reset(new Font(_font2Json, _font2Tex));
-	_font2->baselineToTop = 56;
+	loadJson("trim.json", [this](const Json::Value& json) {
+		_trim.load(json);
+	});
 
 	_bgSprite          = loadSprite("bg.png");
 	_characterSprite   = loadSprite("alice.png", 3, 1);
@@ -114,22 +306,56 @@ void MainState::initialize() {
 	_foodsSprite       = loadSprite("foods.png", 8, 4);
 	_dnSprite          = loadSprite("dn.png");
 	_frameSprite       = loadSprite("frame.png", 3, 3, Texture::NEAREST | Texture::CLAMP);
-	_deadSprite        = loadSprite("alice_dead.png");
-	_splashSprite      = loadSprite("splash.png");
-	_vanishSprite      = loadSprite("vanish.png");
-	_vanishedMsgSprite = loadSprite("msg_vanished.png");
-	_blewupMsgSprite   = loadSprite("msg_crushed.png");
-	_starvedMsgSprite  = loadSprite("msg_starved.png");
+	_deadSprite        = lazySprite("alice_dead.png");
+	_splashSprite      = lazySprite("splash.png");
+	_vanishSprite      = lazySprite("vanish.png");
+	_vanishedMsgSprite = lazySprite("msg_vanished.png", MSG_SCALE);
+	_blewupMsgSprite   = lazySprite("msg_crushed.png",  MSG_SCALE);
+	_starvedMsgSprite  = lazySprite("msg_starved.png",  MSG_SCALE);
 	_helpSprite        = loadSprite("help.png", 2, 1);
 
-	_morningSound      = _game->audio()->loadSound(_game->dataPath() / "morning.ogg");
-	_eveningSound      = _game->audio()->loadSound(_game->dataPath() / "evening.ogg");
-	_eatSound          = _game->audio()->loadSound(_game->dataPath() / "omnomnom.ogg");
-	_drinkSound        = _game->audio()->loadSound(_game->dataPath() / "glouglou.ogg");
-	_discardSound      = _game->audio()->loadSound(_game->dataPath() / "discard.ogg");
-	_vanishSound       = _game->audio()->loadSound(_game->dataPath() / "death.ogg");
-	_blowupSound       = _game->audio()->loadSound(_game->dataPath() / "death.ogg");
-	_starveSound       = _game->audio()->loadSound(_game->dataPath() / "death.ogg");
+	for(auto source: { std::make_pair(&_bgSprite,          "bg"),
+	                   std::make_pair(&_characterSprite,   "alice"),
+	                   std::make_pair(&_barsSprite,        "bars"),
+	                   std::make_pair(&_foodsSprite,       "foods"),
+	                   std::make_pair(&_dnSprite,          "day/night"),
+	                   std::make_pair(&_frameSprite,       "frame"),
+	                   std::make_pair(&_deadSprite,        "alice dead"),
+	                   std::make_pair(&_splashSprite,      "splash"),
+	                   std::make_pair(&_vanishSprite,      "vanish"),
+	                   std::make_pair(&_vanishedMsgSprite, "vanished msg"),
+	                   std::make_pair(&_blewupMsgSprite,   "blew up msg"),
+	                   std::make_pair(&_starvedMsgSprite,  "starved msg"),
+	                   std::make_pair(&_helpSprite,        "help") }) {
+		_renderStats.addSource(source.first->texture(), source.second);
+	}
+
+	// Sounds are not needed to start: they are dropped until decoded.
+	_morningSound = _game->audio()->loadSoundAsync("morning.ogg");
+	_eveningSound = _game->audio()->loadSoundAsync("evening.ogg");
+	_eatSound     = _game->audio()->loadSoundAsync("omnomnom.ogg");
+	_drinkSound   = _game->audio()->loadSoundAsync("glouglou.ogg");
+	_discardSound = _game->audio()->loadSoundAsync("discard.ogg");
+	_vanishSound  = _game->audio()->loadSoundAsync("death.ogg");
+	_blowupSound  = _game->audio()->loadSoundAsync("death.ogg");
+	_starveSound  = _game->audio()->loadSoundAsync("death.ogg");
+
+	// Feedback sounds can be spammed: cap them so they never take over the
+	// mixer. Cues must always be heard.
+	SoundPlayer* audio = _game->audio();
+	audio->setPolicy(_eatSound,     SOUND_PRIORITY_NORMAL,   3, .05);
+	audio->setPolicy(_drinkSound,   SOUND_PRIORITY_NORMAL,   3, .05);
+	audio->setPolicy(_discardSound, SOUND_PRIORITY_LOW,      2, .05);
+	audio->setPolicy(_morningSound, SOUND_PRIORITY_CRITICAL, 1);
+	audio->setPolicy(_eveningSound, SOUND_PRIORITY_CRITICAL, 1);
+	audio->setPolicy(_vanishSound,  SOUND_PRIORITY_CRITICAL, 2);
+}
+
+
+void MainState::createEntities() {
+	// trim.json is loaded by now, so the views will not move anymore.
+	_characterViews = _trim.views(_characterSprite.texture());
+	_foodsViews     = _trim.views(_foodsSprite.texture());
 
 //	_damageAnim.reset(new MoveAnim(ONE_SEC/2, Vector3(0, 30, 0), RELATIVE));
 //	_damageAnim->onEnd = [this](_Entity* e){ _entities.destroyEntity(EntityRef(e)); };
@@ -194,6 +420,8 @@ void MainState::initialize() {
 
 	_frame.background  = &_frameSprite;
 
+	_game->textures()->logResidency();
+
 	_initialized = true;
 }
 
@@ -201,6 +429,24 @@ void MainState::initialize() {
 void MainState::shutdown() {
 //	_game->audio()->releaseMusic(_music1);
 
+	_latency.report(log());
+	_latency.disable();
+	_scheduler.report(log());
+	_frameStats.report(log());
+	_renderStats.report(log());
+	exportFrameStats();
+	_gpuTimer.shutdown();
+	_keyEvents.disable();
+
+	SoundPlayer* audio = _game->audio();
+	audio->logResidency();
+	for(SoundHandle sound: { _morningSound, _eveningSound, _eatSound, _drinkSound,
+	                         _discardSound, _blowupSound, _vanishSound, _starveSound }) {
+		if(sound) {
+			audio->releaseSound(sound);
+		}
+	}
+
 	_slotTracker.disconnectAll();
 
 	_initialized = false;
@@ -213,8 +459,8 @@ void MainState::run() {
 	log().log("Starting main state...");
 	_running = true;
 	_loop.start();
-	_fpsTime  = _game->sys()->getTimeNs();
-	_fpsCount = 0;
+	_scheduler.reset(_loop.frameDuration());
+	_frameStats.setHitchThreshold(2 * std::max(_loop.frameDuration(), _loop.tickDuration()));
 
 	startGame();
 
@@ -245,6 +491,17 @@ void MainState::layoutScreen() {
 		Vector3(0, 0, -1),
 		Vector3(w, h,  1)
 	));
+
+	// Only affects textures loaded from now on.
+	_game->textures()->setViewScale(float(std::min(w, h)) / TEXTURE_REFERENCE_HEIGHT);
+}
+
+
+Eigen::DiagonalMatrix<float, 3> MainState::spriteScaling(const Sprite& sprite,
+                                                         float scale) const {
+	// Compensate for textures loaded from a downscaled variant.
+	float s = scale / _game->textures()->scale(sprite.texture());
+	return Eigen::Scaling(s, s, 1.f);
 }
 
 
@@ -265,38 +522,70 @@ EntityRef MainState::createSprite(Sprite* sprite, const Vector3& pos,
 	EntityRef entity = _entities.createEntity(_entities.root(), name);
 	_sprites.addComponent(entity);
 	entity.sprite()->setSprite(sprite);
-	entity.sprite()->setIndex(index);
+	setSpriteIndex(entity, index);
 	entity.place(Translation(pos) * Eigen::Scaling(scale.x(), scale.y(), 1.f));
 	//_anims.addComponent(entity);
 	return entity;
 }
 
 
+void MainState::setSpriteIndex(EntityRef entity, unsigned index) {
+	setSpriteIndex(entity, index,
+	               _trim.views(entity.sprite()->sprite()->texture()));
+}
+
+
+void MainState::setSpriteIndex(EntityRef entity, unsigned index,
+                               const SpriteTrim::ViewList* views) {
+	SpriteComponent* comp = entity.sprite();
+	comp->setIndex(index);
+
+	// Only emit the opaque part of trimmed tiles. Other sprites keep the
+	// view they manage themselves (see the bars).
+	if(views) {
+		comp->setView(SpriteTrim::view(views, index));
+	}
+}
+
+
 EntityRef MainState::createMovingSprite(Sprite* sprite, int tileIndex,
 										const Vector3& from, const Vector3& to,
-										float duration, const Vector2& anchor) {
+										float duration, const Vector2& anchor,
+										int* slot) {
 	EntityRef entity;
-	for(MovingSprite& ms: _movingSprites) {
+	for(unsigned i = 0; i < _movingSprites.size(); ++i) {
+		MovingSprite& ms = _movingSprites[i];
 		if(ms.timeRemaining <= 0) {
 			entity           = ms.entity;
 			entity.place(Transform(Translation(from)));
 			ms.target        = to;
 			ms.timeRemaining = duration;
+			if(slot) { *slot = i; }
 			break;
 		}
 	}
 	if(!entity.isValid()) {
 		entity = createSprite(sprite, from);
+		if(slot) { *slot = _movingSprites.size(); }
 		_movingSprites.push_back(MovingSprite{entity, to, duration});
 		log().info("Add MovingSprite...");
 	}
 
-	entity.sprite()->setIndex(tileIndex);
+	setSpriteIndex(entity, tileIndex);
 	entity.sprite()->setAnchor(anchor);
 	return entity;
 }
 
 
+// Sends a moving sprite elsewhere, in the time it has left.
+void MainState::retargetMovingSprite(int slot, const Vector3& to) {
+	MovingSprite& ms = _movingSprites[slot];
+	if(ms.timeRemaining > 0) {
+		ms.target = to;
+	}
+}
+
+
 EntityRef MainState::createText(Font* font, const std::string& text,
                                 const Vector3& pos, const Vector4& color) {
 	EntityRef entity = _entities.createEntity(_entities.root(), "text");
@@ -350,8 +639,12 @@ void MainState::loadFoodSettings(const char* filename) {
 	_foodList.clear();
 	_drinkList.clear();
 
-	Path path = _game->dataPath() / filename;
-	std::ifstream jsonFile(path.native());
+	std::string data;
+	if(!_game->assets()->read(filename, &data)) {
+		log().error("Failed to open \"", filename, "\"");
+		return;
+	}
+	std::istringstream jsonFile(data);
 	Json::Value json;
 	try {
 		jsonFile >> json;
@@ -384,8 +677,12 @@ void MainState::loadMotd(const char* filename)
 {
 	_motd.clear();
 
-	Path path = _game->dataPath() / filename;
-	std::ifstream jsonFile(path.native());
+	std::string data;
+	if(!_game->assets()->read(filename, &data)) {
+		log().error("Failed to open \"", filename, "\"");
+		return;
+	}
+	std::istringstream jsonFile(data);
 
 	try {
 		jsonFile >> _motd;
@@ -398,7 +695,6 @@ void MainState::loadMotd(const char* filename)
 
 void MainState::startGame() {
 	_state               = Playing;
-	_lastFrameTime       = _loop.frameTime();
 
 	_playOnce = false;
 
@@ -406,19 +702,28 @@ void MainState::startGame() {
 	_day = _msg = 0;
 	loadMotd("motd.json");
 
-	_drinkDelay = -1;
-	_eatDelay = -1;
+	_drinkTapTime = 0;
+	_eatTapTime = 0;
+	_keyEvents.clear();
+	_history.clear();
+	_eatSprite    = -1;
+	_drinkSprite  = -1;
+	_eatChannel   = -1;
+	_drinkChannel = -1;
 
 	_foodLevel           = MAX_FOOD;
 	_waterLevel          = MAX_DRINK;
 	_size                = START_GROWTH;
+	_prevFoodLevel       = _foodLevel;
+	_prevWaterLevel      = _waterLevel;
 
 	loadFoodSettings("food.json");
 	_foodOfTheDay.clear();
 	_drinkOfTheDay.clear();
 	fetchDailyCrate();
 
-	srand(time(nullptr));
+	// Owned generator, so that it can be saved with the snapshots.
+	_rng.seed(time(nullptr));
 	_foodQueue.clear();
 	_drinkQueue.clear();
 
@@ -440,6 +745,30 @@ void MainState::startGame() {
 	_texts.get(_dayCounter)->text = "";
 
 	_deathTimer = 0;
+
+	evictDeathAssets();
+}
+
+
+void MainState::prefetchDeathAssets() {
+	if(_deathAssetsRequested) {
+		return;
+	}
+
+	log().log("Game over is possible, prefetch death assets...");
+	for(const std::string& file: _deathTextures) {
+		_game->textures()->prefetch(file, Texture::BILINEAR | Texture::CLAMP);
+	}
+	_game->screenState()->prefetchBg("credits.png");
+	_deathAssetsRequested = true;
+}
+
+
+void MainState::evictDeathAssets() {
+	for(const std::string& file: _deathTextures) {
+		_game->textures()->evict(file, Texture::BILINEAR | Texture::CLAMP);
+	}
+	_deathAssetsRequested = false;
 }
 
 //NOTE: Should probably be a lambda or something but frankly IDC.
@@ -491,15 +820,22 @@ void MainState::fetchDailyCrate ()
 
 Foodstuff MainState::randomFood ()
 {
-	return _foodOfTheDay[rand()%_foodOfTheDay.size()];
+	return _foodOfTheDay[_rng()%_foodOfTheDay.size()];
 }
 
 Foodstuff MainState::randomDrink ()
 {
-	return _drinkOfTheDay[rand()%_drinkOfTheDay.size()];
+	return _drinkOfTheDay[_rng()%_drinkOfTheDay.size()];
 }
 
+// Runs timeScale() game steps per loop tick. Input, layout, animations and
+// sounds are handled once per loop tick, so that fast-forward is cheap.
 void MainState::updateTick() {
+	uint64 tickStart = _game->sys()->getTimeNs();
+
+	_prevFoodLevel  = _foodLevel;
+	_prevWaterLevel = _waterLevel;
+
 	if(_game->sys()->getKeyState(SDL_SCANCODE_ESCAPE)) {
 		quit();
 	}
@@ -511,11 +847,116 @@ void MainState::updateTick() {
 		startGame();
 	}
 
+	if(_statsInput->justPressed()) {
+		exportFrameStats();
+	}
+
+	if(_traceInput->justPressed() && Tracer::instance().isEnabled()) {
+		_game->writeTrace();
+	}
+
+#ifdef AHIE_PROFILER
+	if(_profilerInput->justPressed()) {
+		_profiler.setVisible(!_profiler.isVisible());
+	}
+#endif
+
+	// Consumed in every state, so that presses do not pile up.
+	_keyEvents.pop(_loop.tickTime(), &_tickEvents);
+	if(!_tickEvents.empty()) {
+		_latency.inputSeen(_tickEvents.back().time);
+	}
+
+	unsigned scale = timeScale();
+	for(unsigned step = 0; step < scale && _running; ++step) {
+		// Rollbacks may change the outcome of past steps, so the sounds are
+		// played here rather than in simulate(), once the death is committed.
+		State state = committedState();
+		updateGame(step == 0, step + 1 == scale);
+		if(committedState() != state) {
+			switch(committedState()) {
+			case Vanished:
+				playTickSound(_vanishSound);
+				break;
+			case Blown:
+				playTickSound(_blowupSound);
+				break;
+			case Starved:
+				playTickSound(_starveSound);
+				break;
+			case Playing:
+				break;
+			}
+		}
+		_tickEvents.clear();
+		if(committedState() != Playing) {
+			// Nothing to skip on game over.
+			scale = step + 1;
+		}
+	}
+
+	// Coalesced sounds of the batch. Only now do the speculative eat or drink
+	// and the latency probe get their channel.
+	for(SoundHandle sound: _batchSounds) {
+		int channel = _game->audio()->playSoundAt(sound, 0, _loop.tickTime());
+		if(sound == _eatSound && _eatSprite >= 0) {
+			_eatChannel = channel;
+		}
+		if(sound == _drinkSound && _drinkSprite >= 0) {
+			_drinkChannel = channel;
+		}
+		if(sound == _eatSound || sound == _drinkSound || sound == _discardSound) {
+			_latency.action(channel);
+		}
+	}
+	_batchSounds.clear();
+
+	{
+		PROFILE_ZONE(&_profiler, LAYOUT);
+		updateLayout(float(_loop.tickDuration()) * scale / ONE_SEC);
+	}
+	{
+		PROFILE_ZONE(&_profiler, ANIMS);
+		_anims.update(_loop.tickDuration() * scale);
+	}
+	{
+		PROFILE_ZONE(&_profiler, WORLD_TRANSFORM);
+		_entities.updateWorldTransform();
+	}
+
+	uint64 tickEnd = _game->sys()->getTimeNs();
+	_frameStats.addTime(FrameStats::TICKS, tickEnd - tickStart);
+	traceSlice("tick", tickStart, tickEnd);
+}
+
+
+// The game state, except that a death stays speculative while a tap of
+// _history can still be cancelled: a double tap may roll it back.
+MainState::State MainState::committedState() const {
+	return _history.empty()? _state: Playing;
+}
+
+
+unsigned MainState::timeScale() const {
+	unsigned scale = _timeScale;
+	if(_fastForwardInput->isPressed() && committedState() == Playing) {
+		scale = std::max(scale, unsigned(FAST_FORWARD_SCALE));
+	}
+	return std::min(scale, unsigned(MAX_TIME_SCALE));
+}
+
+
+// One game step. Only the first step of a loop tick sees the input, only
+// the last one updates the journal.
+void MainState::updateGame(bool readInput, bool lastStep) {
 	float td = float(_loop.tickDuration()) / ONE_SEC;
 
-	if(_state != Playing) {
+	bool eatPressed   = readInput && _eatInput->justPressed();
+	bool drinkPressed = readInput && _drinkInput->justPressed();
+
+	if(committedState() != Playing) {
 		_deathTimer += td;
-		if(_deathTimer > 2 && (_eatInput->justPressed() || _drinkInput->justPressed())) {
+		if(_deathTimer > 2 && (eatPressed || drinkPressed)) {
 			_game->screenState()->setBg("credits.png");
 			_game->setNextState(_game->screenState());
 			quit();
@@ -523,24 +964,41 @@ void MainState::updateTick() {
 		return;
 	}
 
+	float dayLeft = DAY_LENGTH - _timeOfDay;
 	_timeOfDay += td;
 
 	if (_timeOfDay > DAY_LENGTH)
 	{
+		// The part of the step before the evening still counts.
+		if (dayLeft > 0)
+			integrateEffects(&_activeEffects, dayLeft);
+
+		// Pending taps can not be rolled back across the end of the day. This
+		// also commits a speculative death.
+		_history.clear();
+		_eatTapTime   = 0;
+		_drinkTapTime = 0;
+
+		if (_state != Playing)
+			return;
+
 		if (_day > _motd.size())
 			return; //FIXME: Congratulations ! You win nothing.
 
 		if (_playOnce)
 		{
-			_game->audio()->playSound(_eveningSound, 0);
+			playTickSound(_eveningSound);
 			_playOnce ^= true; //NOTE: Not guilty your honor.
 		}
 
-		if (_drinkInput->justPressed() && _timeOfDay > DAY_LENGTH + MSG_DELAY)
+		if (drinkPressed && _timeOfDay > DAY_LENGTH + MSG_DELAY)
 			_msg++;
 
 		if (_msg < _motd[_day].size())
-			_texts.get(_journal)->text = _motd[_day][_msg].asString();
+		{
+			if (lastStep)
+				_texts.get(_journal)->text = _motd[_day][_msg].asString();
+		}
 		else
 		{
 			_texts.get(_journal)->text = "";
@@ -551,162 +1009,383 @@ void MainState::updateTick() {
 			_timeOfDay = 0;
 			_playOnce ^= true;
 			_texts.get(_dayCounter)->text = "Day " + std::to_string(_day);
-			_game->audio()->playSound(_morningSound, 0);
+			playTickSound(_morningSound);
 		}
 
 		return;
 	}
 
-	for (Effect& e : _activeEffects)
-	{
-		float amount = e.changePerSecond * td;
-		switch (e.type)
-		{
-			case FOOD:
-				_foodLevel += amount;
-				break;
-			case DRINK:
-				_waterLevel += amount;
-				break;
-			case GROWTH:
-				_size += amount;
-				break;
-		}
-		e.effectDuration -= td;
+	TickInput input;
+	input.time = _loop.tickTime();
+	bool cancel = readTaps(&input);
+
+	if(_history.empty() && !input.taps.empty()) {
+		saveSnapshot(&_snapshot);
 	}
 
-	//NOTE: StackOverflow comment (+20) :
-	// "STL 'idioms' like this make me use Python for small projects."
-	_activeEffects.erase(
-		std::remove_if(_activeEffects.begin(), _activeEffects.end(),
-			[] (const Effect& e)->bool { return e.effectDuration <= 0; }),
-		_activeEffects.end());
+	if(cancel) {
+		rollback();
+	}
+	simulate(input, true);
 
-	if (_eatInput->justPressed()) {
-		if (_eatDelay < 0)
-			_eatDelay = 0;
-		else if (_eatDelay < DOUBLE_TAP_TIME)
-		{
-			Vector3 pp = _foodEntities[0].transform().translation();
-			createMovingSprite(&_foodsSprite, _foodQueue.front().tileIndex,
-			                   pp, Vector3(- 32, pp.y(), 0), .5);
-
-			_game->audio()->playSound(_discardSound, 0);
-			_foodQueue.pop_front();
-			_foodQueueOffset += 1;
-			_foodQueue.push_back(randomFood());
-			_eatDelay = -1;
+	if(_eatTapTime || _drinkTapTime) {
+		_history.push_back(std::move(input));
+		if(_history.size() > SPECULATION_MAX_TICKS) {
+			rebaseHistory();
 		}
+	} else {
+		// No tap can be cancelled anymore, commit.
+		_history.clear();
+	}
+	if(!_eatTapTime) {
+		_eatSprite  = -1;
+		_eatChannel = -1;
+	}
+	if(!_drinkTapTime) {
+		_drinkSprite  = -1;
+		_drinkChannel = -1;
 	}
 
-	if (_eatDelay > DOUBLE_TAP_TIME)
-	{
-		if (_foodLevel < MAX_FOOD)
-		{
-			Vector3 pp = _foodEntities[0].transform().translation();
-			createMovingSprite(&_foodsSprite, _foodQueue.front().tileIndex,
-			                   pp, aliceMouthPos(), .5);
+// 	log().info("food: ", _foodLevel, ", water: ", _waterLevel, ", size: ", _size);
+}
 
-			_game->audio()->playSound(_eatSound, 0);
-			for (Effect& e : _foodQueue[0].effects)
-				_activeEffects.push_back(e);
 
-			_foodQueue.pop_front();
-			_foodQueueOffset += 1;
-			_foodQueue.push_back(randomFood());
+// Plays a sound at the tick time. During fast-forward, sounds are coalesced
+// and played once after the batch of steps, see isCoalescing().
+int MainState::playTickSound(SoundHandle sound) {
+	if(isCoalescing()) {
+		if(std::find(_batchSounds.begin(), _batchSounds.end(), sound) == _batchSounds.end()) {
+			_batchSounds.push_back(sound);
 		}
-		_eatDelay = -1;
+		return -1;
 	}
-	else if (_eatDelay >= 0)
-		_eatDelay += td;
+	return _game->audio()->playSoundAt(sound, 0, _loop.tickTime());
+}
 
-	if (_drinkInput->justPressed()) {
-		if (_drinkDelay < 0)
-			_drinkDelay = 0;
-		else if (_drinkDelay < DOUBLE_TAP_TIME)
-		{
-			Vector3 pp = _drinkEntities[0].transform().translation();
-			int w = _game->window()->width();
-			createMovingSprite(&_foodsSprite, _drinkQueue.front().tileIndex,
-			                   pp, Vector3(w + 32, pp.y(), 0), .5);
-
-			_game->audio()->playSound(_discardSound, 0);
-			_drinkQueue.pop_front();
-			_drinkQueueOffset += 1;
-			_drinkQueue.push_back(randomDrink());
-			_drinkDelay = -1;
+
+// If true, playTickSound() returns -1 instead of a channel: the channel of
+// the sound is only known after the batch, in updateTick().
+bool MainState::isCoalescing() const {
+	return timeScale() > 1;
+}
+
+
+// Turns the key presses of the tick into taps. A press soon enough after a
+// tap makes a double tap: the first one is cancelled and the second one
+// discards. Returns true if the cancelled tap is in _history, which then
+// needs a rollback.
+bool MainState::readTaps(TickInput* input) {
+	bool cancelHistory = false;
+	for(const KeyEventQueue::Event& event: _tickEvents) {
+		TapEvent tap;
+		tap.meter = Meter(event.id);
+		tap.tap   = TAP;
+		tap.time  = event.time;
+
+		// The first tap may be in this tick or in the history.
+		uint64 prevTime = (tap.meter == FOOD)? _eatTapTime: _drinkTapTime;
+		int    prev     = -1;
+		for(int i = 0; i < int(input->taps.size()); ++i) {
+			if(input->taps[i].meter == tap.meter) {
+				prev     = (input->taps[i].tap == TAP)? i: -1;
+				prevTime = (input->taps[i].tap == TAP)? input->taps[i].time: 0;
+			}
 		}
+
+		if(prevTime && tap.time - prevTime < DOUBLE_TAP_TIME_NS) {
+			tap.tap = DISCARD_TAP;
+			if(prev >= 0) {
+				input->taps[prev].tap = CANCELLED_TAP;
+			} else {
+				for(TickInput& past: _history) {
+					for(TapEvent& pastTap: past.taps) {
+						if(pastTap.meter == tap.meter && pastTap.time == prevTime) {
+							pastTap.tap = CANCELLED_TAP;
+						}
+					}
+				}
+				cancelHistory = true;
+			}
+		}
+		input->taps.push_back(tap);
 	}
+	return cancelHistory;
+}
 
-	if (_drinkDelay > DOUBLE_TAP_TIME)
-	{
-		if (_waterLevel < MAX_DRINK)
-		{
-			Vector3 pp = _drinkEntities[0].transform().translation();
-			createMovingSprite(&_foodsSprite, _drinkQueue.front().tileIndex,
-			                   pp, aliceMouthPos(), .5);
 
-			_game->audio()->playSound(_drinkSound, 0);
-			for (Effect& e : _drinkQueue[0].effects)
-				_activeEffects.push_back(e);
+// One tick of the game while the day runs. It must only depend on the
+// snapshot state and input, so that rollback() can replay it. If live is
+// false, it has no visible or audible effect. After a speculative death, the
+// pending taps still expire so that the death gets committed.
+void MainState::simulate(const TickInput& input, bool live) {
+	if(_state == Playing) {
+		float td = float(_loop.tickDuration()) / ONE_SEC;
 
-			_drinkQueue.pop_front();
-			_drinkQueueOffset += 1;
-			_drinkQueue.push_back(randomDrink());
+		integrateEffects(&_activeEffects, td);
+
+		for(const TapEvent& tap: input.taps) {
+			simulateTap(tap, input.time, live);
 		}
-		_drinkDelay = -1;
 	}
-	else if (_drinkDelay >= 0)
-		_drinkDelay += td;
+
+	if(_eatTapTime   && input.time - _eatTapTime   > DOUBLE_TAP_TIME_NS) { _eatTapTime   = 0; }
+	if(_drinkTapTime && input.time - _drinkTapTime > DOUBLE_TAP_TIME_NS) { _drinkTapTime = 0; }
+
+	if (_foodLevel  < MAX_FOOD  * DEATH_HINT_RATIO
+	 || _waterLevel < MAX_DRINK * DEATH_HINT_RATIO
+	 || _size < TINY_GROWTH || _size > HUGE_GROWTH)
+		prefetchDeathAssets();
+
+	// Taps may cross a threshold too. Already dead if integrateEffects()
+	// crossed one first.
+	if (_state != Playing)
+		return;
 
 	if (_size <= 0)
 	{
-		_game->audio()->playSound(_vanishSound, 0);
 		_state = Vanished;
 // 		_texts.get(_deathMsg)->text = "You shrunk into\nnothingness...";
 	}
 
 	if (_size > MAX_GROWTH)
 	{
-		_game->audio()->playSound(_blowupSound, 0);
 		_state = Blown;
 // 		_texts.get(_deathMsg)->text = "You got crushed...";
 	}
 
 	if (_foodLevel <= 0 || _waterLevel <= 0)
 	{
-		_game->audio()->playSound(_starveSound, 0);
 		_state = Starved;
 // 		if(_foodLevel <= 0)
 // 			_texts.get(_deathMsg)->text = "You died of\nhunger...";
 // 		else
 // 			_texts.get(_deathMsg)->text = "You died of\nthirst...";
 	}
+}
 
-// 	log().info("food: ", _foodLevel, ", water: ", _waterLevel, ", size: ", _size);
+
+// Integrates effects over the next td seconds and removes the expired
+// ones. Rates are constant between the expiries of effects, so meters are
+// integrated exactly segment by segment, whatever the tick duration. If a
+// meter crosses a death threshold, the game stops at that exact time.
+void MainState::integrateEffects(std::vector<Effect>* effects, float td) {
+	float t = 0;
+	while(t < td && _state == Playing) {
+		// Rates until the next expiry. Durations are counted from the start
+		// of the step.
+		float rate[3] = { 0, 0, 0 };
+		float end = td;
+		for(const Effect& e: *effects) {
+			if(e.effectDuration > t) {
+				rate[e.type] += e.changePerSecond;
+				end = std::min(end, e.effectDuration);
+			}
+		}
+
+		// Earliest crossing in the segment. On ties, the last check wins, as
+		// in simulate().
+		float dt    = end - t;
+		State death = Playing;
+		auto  cross = [&](float level, float r, float threshold, bool above, State state) {
+			float left = threshold - level;
+			if((above? r > 0 && level + r * dt >  threshold
+			         : r < 0 && level + r * dt <= threshold)
+			&& left / r <= dt) {
+				dt    = std::max(left / r, 0.f);
+				death = state;
+			}
+		};
+		cross(_size,       rate[GROWTH], 0,          false, Vanished);
+		cross(_size,       rate[GROWTH], MAX_GROWTH, true,  Blown);
+		cross(_foodLevel,  rate[FOOD],   0,          false, Starved);
+		cross(_waterLevel, rate[DRINK],  0,          false, Starved);
+
+		_foodLevel  += rate[FOOD]   * dt;
+		_waterLevel += rate[DRINK]  * dt;
+		_size       += rate[GROWTH] * dt;
+		t += dt;
+		if(death != Playing) {
+			_state = death;
+		}
+	}
+
+	for (Effect& e : *effects)
+		e.effectDuration -= td;
+
+	//NOTE: StackOverflow comment (+20) :
+	// "STL 'idioms' like this make me use Python for small projects."
+	effects->erase(
+		std::remove_if(effects->begin(), effects->end(),
+			[] (const Effect& e)->bool { return e.effectDuration <= 0; }),
+		effects->end());
 }
 
 
-void MainState::updateFrame() {
-	float fd = float(_loop.frameTime() - _lastFrameTime) / ONE_SEC;
+// Applies a tap of the step that ends at stepTime.
+void MainState::simulateTap(const TapEvent& event, uint64 stepTime, bool live) {
+	Tap  tap  = event.tap;
+	bool food = (event.meter == FOOD);
+	std::deque<Foodstuff>&  queue    = food? _foodQueue:       _drinkQueue;
+	std::vector<EntityRef>& entities = food? _foodEntities:    _drinkEntities;
+	float&                  offset   = food? _foodQueueOffset: _drinkQueueOffset;
+	uint64&                 tapTime  = food? _eatTapTime:      _drinkTapTime;
+	int&                    sprite   = food? _eatSprite:       _drinkSprite;
+	int&                    channel  = food? _eatChannel:      _drinkChannel;
+	float                   level    = food? _foodLevel:       _waterLevel;
+	float                   maxLevel = food? MAX_FOOD:         MAX_DRINK;
+
+	switch(tap) {
+	case NO_TAP:
+		break;
+	case TAP:
+	case CANCELLED_TAP:
+		tapTime = event.time;
+		if(live) {
+			sprite  = -1;
+			channel = -1;
+		}
+		if (tap == TAP && level < maxLevel)
+		{
+			if(live) {
+				Vector3 pp = entities[0].transform().translation();
+				createMovingSprite(&_foodsSprite, queue.front().tileIndex,
+				                   pp, aliceMouthPos(), .5, Vector2(.5, .5), &sprite);
+
+				channel = playTickSound(food? _eatSound: _drinkSound);
+				if(!isCoalescing()) {
+					_latency.action(channel);
+				}
+				offset += 1;
+			}
 
+			// Effects run from the key press to the end of the step, and may
+			// cross a death threshold on the way.
+			float elapsed = std::min(float(stepTime - std::min(event.time, stepTime)) / ONE_SEC,
+			                         float(_loop.tickDuration()) / ONE_SEC);
+			std::vector<Effect> effects = queue[0].effects;
+			integrateEffects(&effects, elapsed);
+			_activeEffects.insert(_activeEffects.end(), effects.begin(), effects.end());
+
+			queue.pop_front();
+			queue.push_back(food? randomFood(): randomDrink());
+		}
+		break;
+	case DISCARD_TAP:
+		if(live) {
+			Vector3 pp = entities[0].transform().translation();
+			int w = _game->window()->width();
+			Vector3 target = food? Vector3(- 32, pp.y(), 0): Vector3(w + 32, pp.y(), 0);
+			if(sprite >= 0) {
+				// The speculative eat is already flying to Alice and the queue
+				// has scrolled, send it away instead.
+				retargetMovingSprite(sprite, target);
+				_game->audio()->haltSound(channel);
+			} else {
+				createMovingSprite(&_foodsSprite, queue.front().tileIndex,
+				                   pp, target, .5);
+				offset += 1;
+			}
+
+			int discardChannel = playTickSound(_discardSound);
+			if(!isCoalescing()) {
+				_latency.action(discardChannel);
+			}
+		}
+
+		queue.pop_front();
+		queue.push_back(food? randomFood(): randomDrink());
+		tapTime = 0;
+		break;
+	}
+}
+
+
+void MainState::rollback() {
+	restoreSnapshot(_snapshot);
+	for(const TickInput& past: _history) {
+		simulate(past, false);
+	}
+}
+
+
+// Moves the snapshot forward to the oldest pending tap, so that _history
+// does not grow while taps keep overlapping.
+void MainState::rebaseHistory() {
+	uint64 oldest = std::min(_eatTapTime?   _eatTapTime:   ~uint64(0),
+	                         _drinkTapTime? _drinkTapTime: ~uint64(0));
+	unsigned first = 0;
+	while(first < _history.size() && _history[first].time < oldest) {
+		++first;
+	}
+	if(first == 0) {
+		return;
+	}
+
+	Snapshot current;
+	saveSnapshot(&current);
+	restoreSnapshot(_snapshot);
+	for(unsigned i = 0; i < first; ++i) {
+		simulate(_history[i], false);
+	}
+	saveSnapshot(&_snapshot);
+	restoreSnapshot(current);
+
+	_history.erase(_history.begin(), _history.begin() + first);
+}
+
+
+void MainState::saveSnapshot(Snapshot* snapshot) const {
+	snapshot->state         = _state;
+	snapshot->foodLevel     = _foodLevel;
+	snapshot->waterLevel    = _waterLevel;
+	snapshot->size          = _size;
+	snapshot->eatTapTime    = _eatTapTime;
+	snapshot->drinkTapTime  = _drinkTapTime;
+	snapshot->activeEffects = _activeEffects;
+	snapshot->foodQueue     = _foodQueue;
+	snapshot->drinkQueue    = _drinkQueue;
+	snapshot->rng           = _rng;
+}
+
+
+void MainState::restoreSnapshot(const Snapshot& snapshot) {
+	_state         = snapshot.state;
+	_foodLevel     = snapshot.foodLevel;
+	_waterLevel    = snapshot.waterLevel;
+	_size          = snapshot.size;
+	_eatTapTime    = snapshot.eatTapTime;
+	_drinkTapTime  = snapshot.drinkTapTime;
+	_activeEffects = snapshot.activeEffects;
+	_foodQueue     = snapshot.foodQueue;
+	_drinkQueue    = snapshot.drinkQueue;
+	_rng           = snapshot.rng;
+}
+
+
+// Places the entities for the current tick. Frames interpolate between
+// the last two ticks.
+void MainState::updateLayout(float td) {
 	int w = _game->window()->width();
 	int h = _game->window()->height();
 
-	float bgScale = std::min(float(w) / _bgSprite.width(),
-	                         float(h) / _bgSprite.height());
+	float bgTexScale = _game->textures()->scale(_bgSprite.texture());
+	float bgScale = std::min(float(w) * bgTexScale / _bgSprite.width(),
+	                         float(h) * bgTexScale / _bgSprite.height());
 	auto bgScaling = Eigen::Scaling(bgScale, bgScale, 1.f);
-	_bg.place(Translation(Vector3(w/2., h/2., -1)) * bgScaling);
+	_bg.place(Translation(Vector3(w/2., h/2., -1)) * spriteScaling(_bgSprite, bgScale));
+
+	// A speculative death is not shown until it is committed.
+	State state = committedState();
 
 	float charScale = bgScale * _size / MAX_GROWTH; //h / 5000. * _size / START_GROWTH;
-	_character.place(Translation(Vector3(w/2, h*0.106, (_state == Playing)? 0: -2))
-	               * Eigen::Scaling(charScale, charScale, 1.f));
+	_character.place(Translation(Vector3(w/2, h*0.106, (state == Playing)? 0: -2))
+	               * spriteScaling(_characterSprite, charScale));
 	if (_size < TINY_GROWTH)
-		_character.sprite()->setIndex(2);
+		setSpriteIndex(_character, 2, _characterViews);
 	else if (_size > HUGE_GROWTH)
-		_character.sprite()->setIndex(1);
+		setSpriteIndex(_character, 1, _characterViews);
 	else
-		_character.sprite()->setIndex(0);
+		setSpriteIndex(_character, 0, _characterViews);
 
 	_journal.place(Transform(Translation(Vector3(w/10, 9./10. * h, 1))));
 
@@ -715,110 +1394,201 @@ void MainState::updateFrame() {
 	float   rightSide = (w + std::min(w, h)) / 2.;
 	Vector3 fbPos(leftSide,  barHeight, .5);
 	Vector3 dbPos(rightSide, barHeight, .5);
-	_foodBar   .place(Translation(fbPos)                     * bgScaling);
-	_foodBarBg .place(Translation(fbPos - Vector3(0, 0, .1)) * bgScaling);
-	_foodBarFg .place(Translation(fbPos + Vector3(0, 0, .1)) * bgScaling);
-	_waterBar  .place(Translation(dbPos)                     * bgScaling);
-	_waterBarBg.place(Translation(dbPos - Vector3(0, 0, .1)) * bgScaling);
-	_waterBarFg.place(Translation(dbPos + Vector3(0, 0, .1)) * bgScaling);
-
-	_foodBar .sprite()->setView(Box2(Vector2(0, 0),
-	                                 Vector2(1, std::min(_foodLevel / MAX_FOOD,   1.f))));
-	_waterBar.sprite()->setView(Box2(Vector2(0, 0),
-	                                 Vector2(1, std::min(_waterLevel / MAX_DRINK, 1.f))));
+	auto barsScaling = spriteScaling(_barsSprite, bgScale);
+	_foodBar   .place(Translation(fbPos)                     * barsScaling);
+	_foodBarBg .place(Translation(fbPos - Vector3(0, 0, .1)) * barsScaling);
+	_foodBarFg .place(Translation(fbPos + Vector3(0, 0, .1)) * barsScaling);
+	_waterBar  .place(Translation(dbPos)                     * barsScaling);
+	_waterBarBg.place(Translation(dbPos - Vector3(0, 0, .1)) * barsScaling);
+	_waterBarFg.place(Translation(dbPos + Vector3(0, 0, .1)) * barsScaling);
 
 	float stackOffset = STACK_OFFSET * bgScale;
-	_foodQueueOffset  = std::max(_foodQueueOffset  - QUEUE_SCROLL_SPEED * fd, 0.);
-	_drinkQueueOffset = std::max(_drinkQueueOffset - QUEUE_SCROLL_SPEED * fd, 0.);
+	_foodQueueOffset  = std::max(_foodQueueOffset  - QUEUE_SCROLL_SPEED * td, 0.);
+	_drinkQueueOffset = std::max(_drinkQueueOffset - QUEUE_SCROLL_SPEED * td, 0.);
 	Vector3 foodEntityPos (leftSide  - STACK_OFFSET * bgScale * .65,
 	                       9./16. * h + _foodQueueOffset  * stackOffset, .5);
 	Vector3 drinkEntityPos(rightSide + STACK_OFFSET * bgScale * .65,
 	                       9./16. * h + _drinkQueueOffset * stackOffset, .5);
+	auto foodsScaling = spriteScaling(_foodsSprite, bgScale);
 	for (unsigned i = 0; i < FOOD_QUEUE_SIZE; ++i) {
-		_foodEntities[i] .place(Translation(foodEntityPos)  * bgScaling);
-		_drinkEntities[i].place(Translation(drinkEntityPos) * bgScaling);
+		_foodEntities[i] .place(Translation(foodEntityPos)  * foodsScaling);
+		_drinkEntities[i].place(Translation(drinkEntityPos) * foodsScaling);
 		foodEntityPos  += Vector3(0, stackOffset, 0);
 		drinkEntityPos += Vector3(0, stackOffset, 0);
-		_foodEntities [i].sprite()->setIndex((i < _foodQueue .size())?_foodQueue [i].tileIndex:31);
-		_drinkEntities[i].sprite()->setIndex((i < _drinkQueue.size())?_drinkQueue[i].tileIndex:31);
+		setSpriteIndex(_foodEntities [i], (i < _foodQueue .size())?_foodQueue [i].tileIndex:31, _foodsViews);
+		setSpriteIndex(_drinkEntities[i], (i < _drinkQueue.size())?_drinkQueue[i].tileIndex:31, _foodsViews);
 	}
 
 	for(MovingSprite& ms: _movingSprites) {
 		if(ms.timeRemaining > 0) {
 			Vector3 pos = ms.entity.transform().translation();
 			Vector3 diff = ms.target - pos;
-			ms.entity.place(Translation(pos + diff * (fd / ms.timeRemaining)) * bgScaling);
-			ms.timeRemaining -= fd;
+			ms.entity.place(Translation(pos + diff * std::min(td / ms.timeRemaining, 1.f))
+			                * foodsScaling);
+			ms.timeRemaining -= td;
 		} else {
-			ms.entity.place(Transform(Translation(Vector3(-1000, -1000, -1000))));
+			// Hidden where it stopped, so that interpolation does not sweep
+			// it across the screen.
+			Vector3 pos = ms.entity.transform().translation();
+			ms.entity.place(Transform(Translation(Vector3(pos.x(), pos.y(), -1000))));
 		}
 	}
 
 	float time = std::min(_timeOfDay / DAY_LENGTH, 1.f);
 	_dn.place(Translation(Vector3(w*.5, h, .2))
-		* AngleAxis(-time * M_PI * 2., Vector3::UnitZ()));
+		* AngleAxis(-time * M_PI * 2., Vector3::UnitZ())
+		* spriteScaling(_dnSprite, 1));
 
-	_dead  .place(Translation(w*.5, h*.1, (_state == Starved)?  .9: -2)
-	            * Eigen::Scaling(charScale, charScale, 1.f));
-	_splash.place(Translation(w*.5, h*.5, (_state == Blown)?    .9: -2) * bgScaling);
-	_vanish.place(Translation(w*.5, h*.1, (_state == Vanished)? .9: -2) * bgScaling);
+	_dead  .place(Translation(w*.5, h*.1, (state == Starved)?  .9: -2)
+	            * spriteScaling(_deadSprite, charScale));
+	_splash.place(Translation(w*.5, h*.5, (state == Blown)?    .9: -2)
+	            * spriteScaling(_splashSprite, bgScale));
+	_vanish.place(Translation(w*.5, h*.1, (state == Vanished)? .9: -2)
+	            * spriteScaling(_vanishSprite, bgScale));
 
 	_dayCounter.place(Translation(w*.5 - h*.42, h * .92, .7) * bgScaling);
 // 	_deathMsg  .place(Translation(w*.4, h*.6, 1) * bgScaling);
 
-	auto msgScaling = Eigen::Scaling(2.f/5.f, 2.f/5.f, 1.f);
-	_vanishedMsg.place(Transform(Translation(Vector3(w/2, h/2,(_state==Vanished)?1:-2))
-	                   * msgScaling * bgScaling));
-	_blewupMsg  .place(Transform(Translation(Vector3(w/2, h/2,(_state==Blown)?1:-2))
-	                   * msgScaling * bgScaling));
-	_starvedMsg .place(Transform(Translation(Vector3(w/2, h/2,(_state==Starved)?1:-2))
-	                   * msgScaling * bgScaling));
+	float msgScale = MSG_SCALE * bgScale;
+	_vanishedMsg.place(Transform(Translation(Vector3(w/2, h/2,(state==Vanished)?1:-2))
+	                   * spriteScaling(_vanishedMsgSprite, msgScale)));
+	_blewupMsg  .place(Transform(Translation(Vector3(w/2, h/2,(state==Blown)?1:-2))
+	                   * spriteScaling(_blewupMsgSprite, msgScale)));
+	_starvedMsg .place(Transform(Translation(Vector3(w/2, h/2,(state==Starved)?1:-2))
+	                   * spriteScaling(_starvedMsgSprite, msgScale)));
 
 
-	_helpFood  .place(Translation(w*.5 - h*.6, h*.47, .6) * bgScaling);
-	_helpDrink .place(Translation(w*.5 + h*.6, h*.47, .6) * bgScaling);
+	auto helpScaling = spriteScaling(_helpSprite, bgScale);
+	_helpFood  .place(Translation(w*.5 - h*.6, h*.47, .6) * helpScaling);
+	_helpDrink .place(Translation(w*.5 + h*.6, h*.47, .6) * helpScaling);
 
 	float margin    = 32;
 	_frame.position = Vector3(w * .1 - margin,   h * .7 + margin, .9);
 	_frame.size     = Vector2(w * .8 + 2*margin, h * .2);
+}
+
+
+void MainState::updateFrame() {
+	// Each section boundary is timed once; FrameStats, the scheduler, the
+	// profiler and the trace all use these times.
+	SysModule* sys = _game->sys();
+	uint64 start = sys->getTimeNs();
+	_scheduler.frameStarted(start);
+	_frameStats.frameStarted(start);
+
+	// Sprites and texts are interpolated by the renderer, the bars are
+	// interpolated here.
+	float interp     = _loop.frameInterp();
+	float foodLevel  = _prevFoodLevel  + (_foodLevel  - _prevFoodLevel)  * interp;
+	float waterLevel = _prevWaterLevel + (_waterLevel - _prevWaterLevel) * interp;
+	_foodBar .sprite()->setView(Box2(Vector2(0, 0),
+	                                 Vector2(1, std::min(foodLevel / MAX_FOOD,   1.f))));
+	_waterBar.sprite()->setView(Box2(Vector2(0, 0),
+	                                 Vector2(1, std::min(waterLevel / MAX_DRINK, 1.f))));
 
 	// Rendering
 
+	uint64 uploadsStart = sys->getTimeNs();
+	_frameStats.addTime(FrameStats::BUILD, uploadsStart - start);
+	_game->updateAssets(TEXTURE_UPLOADS_PER_FRAME);
+	TRACE_COUNTER("pending loads", _loading.total() - _loading.completed());
+	uint64 uploadsEnd = sys->getTimeNs();
+	_frameStats.addTime(FrameStats::UPLOADS, uploadsEnd - uploadsStart);
+	traceSlice("updateAssets", uploadsStart, uploadsEnd);
+
 	glClearColor(133./255., 88./255., 58./255., 1.);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	_game->renderer()->mainBatch().clearBuffers();
 
-	_entities.updateWorldTransform();
-	_sprites.render(_loop.frameInterp(), _camera);
-	_texts.render(  _loop.frameInterp(), _game->renderer());
-	_anims.update(_loop.tickDuration());
+	{
+		PROFILE_ZONE(&_profiler, SPRITES);
+		_sprites.render(interp, _camera);
+	}
+	{
+		PROFILE_ZONE(&_profiler, TEXTS);
+		_texts.render(interp, _game->renderer());
+	}
 
 	if(!_texts.get(_journal)->text.empty()) {
 		_frame.render(_game->renderer());
 	}
 
+	// Before the overlay, which is not part of the game.
+	_renderStats.countBatch(_game->renderer());
+
+#ifdef AHIE_PROFILER
+	if(_profiler.isVisible()) {
+		_profiler.render(_game->renderer(), _font.get(), &_frameSprite,
+		                 Vector3(16, _game->window()->height() - 16, .95),
+		                 _renderStats.summary());
+	}
+#endif
+
+	uint64 buildEnd = sys->getTimeNs();
+	_frameStats.addTime(FrameStats::BUILD, buildEnd - uploadsEnd);
+
 	_game->renderer()->spriteShader()->use();
 	_game->renderer()->spriteShader()->setTextureUnit(0);
 	_game->renderer()->spriteShader()->setViewMatrix(_camera.transform());
-	_game->renderer()->mainBatch().render();
+	{
+		PROFILE_ZONE(&_profiler, BATCH);
+		_gpuTimer.begin();
+		_game->renderer()->mainBatch().render();
+		_gpuTimer.end();
+	}
+
+	uint64 drawEnd = sys->getTimeNs();
+	_frameStats.addTime(FrameStats::DRAW, drawEnd - buildEnd);
 
 	_game->window()->swapBuffers();
+	uint64 present = sys->getTimeNs();
+	_frameStats.addTime(FrameStats::SWAP, present - drawEnd);
+	_latency.framePresented(_game->audio());
+
+	if(_gpuTimer.collect()) {
+		_frameStats.setGpuTime(_gpuTimer.lastTime());
+	}
 
-	uint64 now = _game->sys()->getTimeNs();
-	++_fpsCount;
-	if(_fpsCount == 60) {
-		log().info("Fps: ", _fpsCount * float(ONE_SEC) / (now - _fpsTime));
-		_fpsTime  = now;
-		_fpsCount = 0;
+	// The frame is due at frameTime(): start the next one just early enough.
+	_scheduler.frameEnded(drawEnd, _gpuTimer.lastTime(), present, _loop.frameTime());
+	if(_loop.frameDuration()) {
+		_loop.setFrameMargin(_scheduler.margin());
 	}
 
-	_lastFrameTime = _loop.frameTime();
+	_renderStats.frameEnded();
+	const RenderStats::Counters& counters = _renderStats.lastFrame();
+	_frameStats.setRenderCounts(counters.drawCalls, counters.vertices,
+	                            counters.vertexBytes + counters.textureBytes);
+
+	_frameStats.frameEnded(present);
+#ifdef AHIE_PROFILER
+	_profiler.frameEnded(_frameStats.lastFrame());
+#endif
+	traceSlice("frame", start, present);
 
 	LAIR_LOG_OPENGL_ERRORS_TO(log());
 }
 
 
+void MainState::exportFrameStats() {
+	if(_frameStats.exportCsv(FRAME_STATS_FILE)) {
+		log().info("Frame stats written to ", FRAME_STATS_FILE);
+	} else {
+		log().warning("Failed to write ", FRAME_STATS_FILE);
+	}
+}
+
+
+void MainState::traceSlice(const char* name, uint64 begin, uint64 end) {
+	Tracer& tracer = Tracer::instance();
+	if(tracer.isEnabled()) {
+		uint64 offset = Tracer::now() - _game->sys()->getTimeNs();
+		tracer.recordSlice(name, begin + offset, end + offset);
+	}
+}
+
+
 Vector3 MainState::aliceMouthPos() const {
 	int w = _game->window()->width();
 	int h = _game->window()->height();
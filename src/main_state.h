@@ -24,6 +24,8 @@
 
 #include <vector>
 #include <deque>
+#include <random>
+#include <unordered_map>
 
 #include <lair/core/lair.h>
 #include <lair/core/log.h>
@@ -42,6 +44,15 @@
 #include "text_component.h"
 #include "animation_component.h"
 #include "sound_player.h"
+#include "latency_probe.h"
+#include "key_event_queue.h"
+#include "frame_scheduler.h"
+#include "frame_stats.h"
+#include "render_stats.h"
+#include "profiler.h"
+#include "gpu_timer.h"
+#include "sprite_trim.h"
+#include "task_pool.h"
 
 #include "game_state.h"
 
@@ -69,8 +80,19 @@ class Font;
 
 #define DAY_LENGTH 40
 #define MSG_DELAY .5
+#define MSG_SCALE (2.f/5.f)
+
+// Fast-forward: game steps per loop tick.
+#define MAX_TIME_SCALE 64
+#define FAST_FORWARD_SCALE 16
 
 #define DOUBLE_TAP_TIME 0.3
+#define DOUBLE_TAP_TIME_NS uint64(DOUBLE_TAP_TIME * 1000000000.)
+// Ticks kept for rollback before the speculation snapshot is moved forward.
+#define SPECULATION_MAX_TICKS 120
+
+// Below this fraction of a meter, game over is possible soon.
+#define DEATH_HINT_RATIO .25
 
 enum Meter { FOOD, DRINK, GROWTH };
 
@@ -91,6 +113,25 @@ struct Foodstuff {
 	std::vector<Effect> effects; // List of triggered effects.
 };
 
+// What a tick does with an eat or drink key press.
+enum Tap {
+	NO_TAP,
+	TAP,           // Eat or drink at once, may be rolled back.
+	CANCELLED_TAP, // First tap of a double tap (replay only).
+	DISCARD_TAP    // Second tap of a double tap.
+};
+
+struct TapEvent {
+	Meter  meter; // FOOD (eat) or DRINK.
+	Tap    tap;
+	uint64 time;  // Time of the key press.
+};
+
+struct TickInput {
+	uint64 time;
+	std::vector<TapEvent> taps; // In time order.
+};
+
 struct MovingSprite {
 	EntityRef entity;
 	Vector3   target;
@@ -99,12 +140,26 @@ struct MovingSprite {
 
 
 class MainState : public GameState {
+public:
+	typedef std::function<void()> Callback;
+	typedef std::function<void(const Json::Value&)> JsonCallback;
+
 public:
 	MainState(Game* game);
 	~MainState();
 
 	Sprite loadSprite(const char* file, unsigned th = 1, unsigned tv = 1,
-	                  unsigned flags = Texture::BILINEAR | Texture::CLAMP);
+	                  unsigned flags = Texture::BILINEAR | Texture::CLAMP,
+	                  float displayScale = 1);
+	Sprite lazySprite(const char* file, float displayScale = 1);
+	void loadJson(const char* file, const JsonCallback& callback);
+	void loadFont(const char* file, Texture** tex, Json::Value* json,
+	              std::unique_ptr<Font>* font, unsigned baselineToTop,
+	              const char* statsName);
+	void whenResident(Texture* tex, const Callback& callback);
+
+	bool updateLoading();
+	const LoadProgress& loadingProgress() const;
 
 	virtual void initialize();
 	virtual void shutdown();
@@ -112,19 +167,26 @@ public:
 	virtual void run();
 	virtual void quit();
 
+	void createEntities();
 	void layoutScreen();
+	Eigen::DiagonalMatrix<float, 3> spriteScaling(const Sprite& sprite,
+	                                              float scale) const;
 
 	EntityRef createSprite(Sprite* sprite, const char* name = nullptr,
-	                       unsigned index = 1);
+	                       unsigned index = 0);
 	EntityRef createSprite(Sprite* sprite, const Vector3& pos,
-	                       const char* name = nullptr, unsigned index = 1);
+	                       const char* name = nullptr, unsigned index = 0);
 	EntityRef createSprite(Sprite* sprite, const Vector3& pos,
 	                       const Vector2& scale,
-	                       const char* name = nullptr, unsigned index = 1);
+	                       const char* name = nullptr, unsigned index = 0);
+	void setSpriteIndex(EntityRef entity, unsigned index);
+	void setSpriteIndex(EntityRef entity, unsigned index,
+	                    const SpriteTrim::ViewList* views);
 	EntityRef createMovingSprite(Sprite* sprite, int tileIndex,
 	                             const Vector3& from, const Vector3& to,
 	                             float duration,
-	                             const Vector2& anchor = Vector2(.5, .5));
+	                             const Vector2& anchor = Vector2(.5, .5),
+	                             int* slot = nullptr);
 	EntityRef createText(Font* font, const std::string& msg, const Vector3& pos,
 	                     const Vector4& color = Vector4(1, 1, 1, 1));
 
@@ -134,6 +196,9 @@ public:
 	void loadMotd(const char* filename);
 	void startGame();
 
+	void prefetchDeathAssets();
+	void evictDeathAssets();
+
 	Foodstuff getFoodByName(const std::string& name);
 	void fetchDailyCrate();
 
@@ -141,7 +206,23 @@ public:
 	Foodstuff randomDrink ();
 
 	void updateTick();
+	unsigned timeScale() const;
+	void updateGame(bool readInput, bool lastStep);
+	int playTickSound(SoundHandle sound);
+	bool isCoalescing() const;
+	void updateLayout(float td);
 	void updateFrame();
+	void exportFrameStats();
+	/// Records a slice timed with the sys clock in the trace.
+	void traceSlice(const char* name, uint64 begin, uint64 end);
+
+	bool readTaps(TickInput* input);
+	void simulate(const TickInput& input, bool live);
+	void integrateEffects(std::vector<Effect>* effects, float td);
+	void simulateTap(const TapEvent& event, uint64 stepTime, bool live);
+	void rollback();
+	void rebaseHistory();
+	void retargetMovingSprite(int slot, const Vector3& to);
 
 	Vector3 aliceMouthPos() const;
 
@@ -156,6 +237,24 @@ public:
 		Starved
 	};
 
+	/// Simulation state restored by a rollback.
+	struct Snapshot {
+		State                 state;
+		float                 foodLevel;
+		float                 waterLevel;
+		float                 size;
+		uint64                eatTapTime;
+		uint64                drinkTapTime;
+		std::vector<Effect>   activeEffects;
+		std::deque<Foodstuff> foodQueue;
+		std::deque<Foodstuff> drinkQueue;
+		std::minstd_rand      rng;
+	};
+
+	void saveSnapshot(Snapshot* snapshot) const;
+	void restoreSnapshot(const Snapshot& snapshot);
+	State committedState() const;
+
 public:
 	Game* _game;
 
@@ -171,11 +270,25 @@ public:
 
 	OrthographicCamera _camera;
 
+	struct PendingTexture {
+		Texture* texture;
+		Callback callback;
+	};
+
+	LoadProgress _loading;
+	std::vector<PendingTexture> _pendingTextures;
+
 	bool        _initialized;
 	bool        _running;
 	InterpLoop  _loop;
-	int64       _fpsTime;
-	unsigned    _fpsCount;
+	FrameStats  _frameStats;
+	RenderStats _renderStats;
+	LatencyProbe _latency;
+	FrameScheduler _scheduler;
+	GpuTimer    _gpuTimer;
+#ifdef AHIE_PROFILER
+	Profiler    _profiler;
+#endif
 
 	Texture*    _fontTex;
 	Json::Value _fontJson;
@@ -189,13 +302,27 @@ public:
 
 	std::vector<MovingSprite> _movingSprites;
 
+	SpriteTrim  _trim;
+
 	// Game related stuff
 
 	Input*      _drinkInput;
 	Input*      _eatInput;
 	Input*      _debugInput;
-	float       _drinkDelay;
-	float       _eatDelay;
+	Input*      _fastForwardInput;
+	Input*      _statsInput;
+#ifdef AHIE_PROFILER
+	Input*      _profilerInput;
+#endif
+	Input*      _traceInput;
+	unsigned    _timeScale;
+	std::vector<SoundHandle> _batchSounds;
+	KeyEventQueue _keyEvents;
+	KeyEventQueue::EventList _tickEvents;
+	// Time of the last tap that a second tap could still turn into a discard,
+	// or 0.
+	uint64      _drinkTapTime;
+	uint64      _eatTapTime;
 
 	Sprite      _bgSprite;
 	Sprite      _characterSprite;
@@ -211,14 +338,22 @@ public:
 	Sprite      _starvedMsgSprite;
 	Sprite      _helpSprite;
 
-	const Sound* _morningSound;
-	const Sound* _eveningSound;
-	const Sound* _eatSound;
-	const Sound* _drinkSound;
-	const Sound* _discardSound;
-	const Sound* _blowupSound;
-	const Sound* _vanishSound;
-	const Sound* _starveSound;
+	// Trimmed views of the sprites whose tile changes every frame.
+	const SpriteTrim::ViewList* _characterViews;
+	const SpriteTrim::ViewList* _foodsViews;
+
+	// Only needed on game over, loaded on demand.
+	std::vector<std::string> _deathTextures;
+	bool        _deathAssetsRequested;
+
+	SoundHandle  _morningSound;
+	SoundHandle  _eveningSound;
+	SoundHandle  _eatSound;
+	SoundHandle  _drinkSound;
+	SoundHandle  _discardSound;
+	SoundHandle  _blowupSound;
+	SoundHandle  _vanishSound;
+	SoundHandle  _starveSound;
 	bool        _playOnce;
 
 	EntityRef   _bg;
@@ -249,7 +384,6 @@ public:
 	// Game states
 
 	State       _state;
-	uint64      _lastFrameTime;
 
 	float _timeOfDay;
 	unsigned _day, _msg;
@@ -269,11 +403,26 @@ public:
 	float       _foodLevel;
 	float       _waterLevel;
 	float       _size;
+	// Levels at the previous tick, to interpolate the bars.
+	float       _prevFoodLevel;
+	float       _prevWaterLevel;
 
 	std::vector<Effect> _activeEffects;
 
 	float       _deathTimer;
 
+	std::minstd_rand _rng;
+
+	// Eating and drinking are applied on the first tap. A second tap within
+	// DOUBLE_TAP_TIME restores _snapshot and replays _history (the ticks since
+	// the snapshot) with the first tap cancelled, then discards.
+	Snapshot    _snapshot;
+	std::vector<TickInput> _history;
+	int         _eatSprite;    // Moving sprite slot of the speculative eat, or -1.
+	int         _drinkSprite;
+	int         _eatChannel;   // Sound channel of the speculative eat, or -1.
+	int         _drinkChannel;
+
 };
 
 
@@ -0,0 +1,452 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define MIXER_USE_SSE
+#endif
+
+#include "trace.h"
+
+#include "mixer.h"
+
+
+// out[i] += in[i] * gain
+static void mixSamples(float* out, const float* in, unsigned size, float gain) {
+	unsigned i = 0;
+#ifdef MIXER_USE_SSE
+	__m128 g = _mm_set1_ps(gain);
+	for(; i + 4 <= size; i += 4) {
+		__m128 o = _mm_loadu_ps(out + i);
+		o = _mm_add_ps(o, _mm_mul_ps(_mm_loadu_ps(in + i), g));
+		_mm_storeu_ps(out + i, o);
+	}
+#endif
+	for(; i < size; ++i) {
+		out[i] += in[i] * gain;
+	}
+}
+
+
+Mixer::Mixer()
+    : _open(false),
+      _frequency(0),
+      _nChannels(0),
+      _traceBuffer(nullptr),
+      _commands(),
+      _nextSerial(1),
+      _nPushed(0),
+      _nDropped(0),
+      _nPendingHalts(0),
+      _hasPendingMusic(false),
+      _pendingMusic(),
+      _hasPendingVolume(false),
+      _pendingVolume(0),
+      _nExecuted(0) {
+	for(int i = 0; i < MIXER_MAX_VOICES; ++i) {
+		_serials[i]      = 0;
+		_pendingHalts[i] = 0;
+
+		Voice& voice = _voices[i];
+		voice.samples = nullptr;
+		voice.size    = 0;
+		voice.pos     = 0;
+		voice.loops   = 0;
+		voice.gain    = 0;
+		voice.serial  = 0;
+		voice.delay   = 0;
+		voice.started = false;
+
+		_finished[i]     = 0;
+		_startSerials[i] = 0;
+		_startTimes[i]   = 0;
+	}
+}
+
+
+Mixer::~Mixer() {
+	close();
+}
+
+
+bool Mixer::open() {
+	Uint16 format;
+	if(!Mix_QuerySpec(&_frequency, &format, &_nChannels) || format != AUDIO_F32SYS) {
+		return false;
+	}
+
+	if(!_traceBuffer) {
+		_traceBuffer = Tracer::instance().createBuffer("audio");
+	}
+	Mix_SetPostMix(&Mixer::postMix, this);
+	_open = true;
+	return true;
+}
+
+
+void Mixer::close() {
+	if(_open) {
+		Mix_SetPostMix(nullptr, nullptr);
+		_open = false;
+	}
+}
+
+
+bool Mixer::isOpen() const {
+	return _open;
+}
+
+
+int Mixer::frequency() const {
+	return _frequency;
+}
+
+
+int Mixer::nChannels() const {
+	return _nChannels;
+}
+
+
+lair::uint64 Mixer::now() {
+	lair::uint64 counter = SDL_GetPerformanceCounter();
+	lair::uint64 freq    = SDL_GetPerformanceFrequency();
+	return (counter / freq) * 1000000000ull + (counter % freq) * 1000000000ull / freq;
+}
+
+
+bool Mixer::play(int voice, const Mix_Chunk* chunk, float gain, int loops,
+                 lair::uint64 startTime) {
+	if(chunk->alen < sizeof(float)) {
+		return false;
+	}
+
+	Command command;
+	command.type      = Command::PLAY;
+	command.voice     = voice;
+	command.serial    = _nextSerial++;
+	if(!_nextSerial) {
+		_nextSerial = 1;
+	}
+	command.samples   = reinterpret_cast<const float*>(chunk->abuf);
+	command.size      = chunk->alen / sizeof(float);
+	command.loops     = loops;
+	command.gain      = gain;
+	command.startTime = startTime;
+	command.music     = nullptr;
+	if(!push(command)) {
+		// A late sound effect is worse than none.
+		++_nDropped;
+		return false;
+	}
+
+	_serials[voice] = command.serial;
+	return true;
+}
+
+
+void Mixer::halt(int voice) {
+	if(!_serials[voice]) {
+		return;
+	}
+
+	Command command;
+	command.type      = Command::HALT;
+	command.voice     = voice;
+	command.serial    = _serials[voice];
+	command.samples   = nullptr;
+	command.size      = 0;
+	command.loops     = 0;
+	command.gain      = 0;
+	command.startTime = 0;
+	command.music     = nullptr;
+	if(!push(command)) {
+		if(!_pendingHalts[voice]) {
+			++_nPendingHalts;
+		}
+		_pendingHalts[voice] = command.serial;
+	}
+
+	_serials[voice] = 0;
+}
+
+
+void Mixer::playMusic(Mix_Music* music, int loops) {
+	Command command;
+	command.type      = Command::PLAY_MUSIC;
+	command.voice     = 0;
+	command.serial    = 0;
+	command.samples   = nullptr;
+	command.size      = 0;
+	command.loops     = loops;
+	command.gain      = 0;
+	command.startTime = 0;
+	command.music     = music;
+	if(!push(command)) {
+		// Only the last music command matters.
+		_pendingMusic    = command;
+		_hasPendingMusic = true;
+	}
+}
+
+
+void Mixer::haltMusic() {
+	Command command;
+	command.type      = Command::HALT_MUSIC;
+	command.voice     = 0;
+	command.serial    = 0;
+	command.samples   = nullptr;
+	command.size      = 0;
+	command.loops     = 0;
+	command.gain      = 0;
+	command.startTime = 0;
+	command.music     = nullptr;
+	if(!push(command)) {
+		_pendingMusic    = command;
+		_hasPendingMusic = true;
+	}
+}
+
+
+void Mixer::setMusicVolume(int volume) {
+	Command command;
+	command.type      = Command::MUSIC_VOLUME;
+	command.voice     = volume;
+	command.serial    = 0;
+	command.samples   = nullptr;
+	command.size      = 0;
+	command.loops     = 0;
+	command.gain      = 0;
+	command.startTime = 0;
+	command.music     = nullptr;
+	if(!push(command)) {
+		_pendingVolume    = volume;
+		_hasPendingVolume = true;
+	}
+}
+
+
+void Mixer::flush() {
+	flushPending();
+}
+
+
+bool Mixer::isPlaying(int voice) const {
+	return _serials[voice]
+	    && _finished[voice].load(std::memory_order_acquire) != _serials[voice];
+}
+
+
+bool Mixer::startTime(int voice, lair::uint64* time) const {
+	// Only the game thread starts new serials, so _startTimes can not be
+	// overwritten while it is read.
+	if(!_serials[voice]
+	|| _startSerials[voice].load(std::memory_order_acquire) != _serials[voice]) {
+		return false;
+	}
+	*time = _startTimes[voice].load(std::memory_order_relaxed);
+	return true;
+}
+
+
+// Pending commands are pushed before any other, so they are counted as if
+// they were already.
+unsigned Mixer::fence() const {
+	return _nPushed + _nPendingHalts + (_hasPendingMusic? 1: 0)
+	     + (_hasPendingVolume? 1: 0);
+}
+
+
+bool Mixer::isReached(unsigned fence) const {
+	return int(_nExecuted.load(std::memory_order_acquire) - fence) >= 0;
+}
+
+
+unsigned Mixer::nDropped() const {
+	return _nDropped;
+}
+
+
+// Only the audio thread consumes commands. SDL keeps calling it while the
+// device is open, so a full queue drains within a buffer, but the game thread
+// never waits for it.
+bool Mixer::push(const Command& command) {
+	if(!flushPending() || !_commands.push(command)) {
+		return false;
+	}
+	++_nPushed;
+	return true;
+}
+
+
+bool Mixer::flushPending() {
+	for(int voice = 0; _nPendingHalts && voice < MIXER_MAX_VOICES; ++voice) {
+		if(!_pendingHalts[voice]) {
+			continue;
+		}
+		Command command;
+		command.type      = Command::HALT;
+		command.voice     = voice;
+		command.serial    = _pendingHalts[voice];
+		command.samples   = nullptr;
+		command.size      = 0;
+		command.loops     = 0;
+		command.gain      = 0;
+		command.startTime = 0;
+		command.music     = nullptr;
+		if(!_commands.push(command)) {
+			return false;
+		}
+		++_nPushed;
+		_pendingHalts[voice] = 0;
+		--_nPendingHalts;
+	}
+
+	if(_hasPendingMusic) {
+		if(!_commands.push(_pendingMusic)) {
+			return false;
+		}
+		++_nPushed;
+		_hasPendingMusic = false;
+	}
+
+	if(_hasPendingVolume) {
+		Command command;
+		command.type      = Command::MUSIC_VOLUME;
+		command.voice     = _pendingVolume;
+		command.serial    = 0;
+		command.samples   = nullptr;
+		command.size      = 0;
+		command.loops     = 0;
+		command.gain      = 0;
+		command.startTime = 0;
+		command.music     = nullptr;
+		if(!_commands.push(command)) {
+			return false;
+		}
+		++_nPushed;
+		_hasPendingVolume = false;
+	}
+	return true;
+}
+
+
+// Audio thread only.
+void Mixer::execCommands(lair::uint64 callbackTime) {
+	unsigned nExecuted = _nExecuted.load(std::memory_order_relaxed);
+	Command command;
+	while(_commands.pop(&command)) {
+		++nExecuted;
+		// SDL_mixer takes its lock again, which is recursive.
+		switch(command.type) {
+		case Command::PLAY_MUSIC:
+			Mix_PlayMusic(command.music, command.loops);
+			continue;
+		case Command::HALT_MUSIC:
+			Mix_HaltMusic();
+			continue;
+		case Command::MUSIC_VOLUME:
+			Mix_VolumeMusic(command.voice);
+			continue;
+		case Command::PLAY:
+		case Command::HALT:
+			break;
+		}
+
+		Voice& voice = _voices[command.voice];
+		if(voice.samples) {
+			// Interrupted, or halted.
+			_finished[command.voice].store(voice.serial, std::memory_order_release);
+			voice.samples = nullptr;
+		}
+		if(command.type == Command::PLAY) {
+			voice.samples = command.samples;
+			voice.size    = command.size;
+			voice.pos     = 0;
+			voice.loops   = command.loops;
+			voice.gain    = command.gain;
+			voice.serial  = command.serial;
+			voice.delay   = 0;
+			voice.started = false;
+
+			// Past or current timestamps start at the beginning of this
+			// buffer, without added latency.
+			if(command.startTime > callbackTime) {
+				lair::uint64 offset = command.startTime - callbackTime;
+				voice.delay = unsigned(offset * _frequency / 1000000000ull) * _nChannels;
+			}
+		}
+	}
+	// Voices halted or replaced by these commands no longer read their chunk,
+	// and musics replaced or halted are no longer played.
+	_nExecuted.store(nExecuted, std::memory_order_release);
+}
+
+
+// Called by SDL_mixer, from the audio thread, with the audio lock held.
+void Mixer::postMix(void* mixer, Uint8* stream, int len) {
+	static_cast<Mixer*>(mixer)->mix(reinterpret_cast<float*>(stream), len / sizeof(float));
+}
+
+
+void Mixer::mix(float* out, unsigned size) {
+	Tracer::instance().useBuffer(_traceBuffer);
+	TRACE_SCOPE("Mixer::mix");
+
+	lair::uint64 callbackTime = now();
+	execCommands(callbackTime);
+
+	int nVoices = 0;
+	for(int i = 0; i < MIXER_MAX_VOICES; ++i) {
+		Voice& voice = _voices[i];
+		nVoices += voice.samples? 1: 0;
+		unsigned done = 0;
+		if(voice.samples && voice.delay) {
+			unsigned skip = std::min(voice.delay, size);
+			voice.delay -= skip;
+			done        += skip;
+		}
+		if(voice.samples && !voice.started && done < size) {
+			voice.started = true;
+			lair::uint64 offset = lair::uint64(done / _nChannels) * 1000000000ull / _frequency;
+			_startTimes[i].store(callbackTime + offset, std::memory_order_relaxed);
+			_startSerials[i].store(voice.serial, std::memory_order_release);
+		}
+		while(voice.samples && done < size) {
+			unsigned count = std::min(size - done, voice.size - voice.pos);
+			mixSamples(out + done, voice.samples + voice.pos, count, voice.gain);
+			done      += count;
+			voice.pos += count;
+
+			if(voice.pos == voice.size) {
+				voice.pos = 0;
+				if(voice.loops == 0) {
+					voice.samples = nullptr;
+					_finished[i].store(voice.serial, std::memory_order_release);
+				} else if(voice.loops > 0) {
+					--voice.loops;
+				}
+			}
+		}
+	}
+
+	TRACE_COUNTER("voices", nVoices);
+}
@@ -0,0 +1,186 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_MIXER_H
+#define _AHIE_MIXER_H
+
+
+#include <atomic>
+
+#include <SDL_mixer.h>
+
+#include <lair/core/lair.h>
+
+#include "spsc_queue.h"
+#include "trace.h"
+
+
+#define MIXER_MAX_VOICES   32
+#define MIXER_QUEUE_SIZE   256
+
+
+/// Sound effect mixer running in the audio callback.
+///
+/// SDL_mixer is opened with 32 bits float samples (and a small buffer in
+/// low-latency mode); the chunks it decodes are then already float PCM at the device rate and
+/// format. The mixer adds its voices to SDL_mixer's output (music) from a
+/// post-mix hook, with SSE when available.
+///
+/// Voices are indexed like SDL_mixer channels so that SoundPlayer can
+/// allocate them the same way.
+///
+/// play(), halt() and the music commands do not take the audio lock: they
+/// push commands in a wait-free queue that only the audio callback drains.
+/// They must be called from a single thread. isPlaying() reflects the
+/// commands already pushed. Nothing waits for the audio thread either: when
+/// the queue is full, plays are dropped (and counted), while halts and music
+/// commands are kept aside, coalesced, and pushed by the next command or
+/// flush().
+///
+/// A chunk or a music may only be freed once the audio thread stopped
+/// reading it: halt the voices that play it, take a fence() and wait for
+/// isReached().
+class Mixer {
+public:
+	Mixer();
+	Mixer(const Mixer&) = delete;
+	~Mixer();
+
+	Mixer& operator=(const Mixer&) = delete;
+
+	/// Fails if the device does not use float samples.
+	bool open();
+	void close();
+	bool isOpen() const;
+
+	int  frequency() const;
+	int  nChannels() const;
+
+	/// Mixer clock, in nanoseconds.
+	static lair::uint64 now();
+
+	/// If startTime (mixer clock) is in the future, the voice starts at the
+	/// matching sample, so that sounds keep the spacing of their timestamps.
+	/// Otherwise it starts with the next buffer. Fails if the queue is full.
+	bool play(int voice, const Mix_Chunk* chunk, float gain, int loops,
+	          lair::uint64 startTime = 0);
+	void halt(int voice);
+	/// Music commands are applied by the audio thread, which already holds
+	/// the audio lock.
+	void playMusic(Mix_Music* music, int loops);
+	void haltMusic();
+	void setMusicVolume(int volume);
+	/// Pushes the commands kept aside while the queue was full.
+	void flush();
+	bool isPlaying(int voice) const;
+	/// Time (mixer clock) of the first sample of the last sound played on
+	/// voice, once the audio callback reached it.
+	bool startTime(int voice, lair::uint64* time) const;
+
+	/// Number of commands issued so far.
+	unsigned fence() const;
+	/// True once the audio thread applied every command pushed before fence
+	/// was taken.
+	bool isReached(unsigned fence) const;
+	/// Plays dropped because the queue was full.
+	unsigned nDropped() const;
+
+protected:
+	struct Voice {
+		const float* samples;
+		unsigned     size;
+		unsigned     pos;
+		int          loops;
+		float        gain;
+		unsigned     serial;
+		unsigned     delay;
+		bool         started;
+	};
+
+	struct Command {
+		enum Type {
+			PLAY,
+			HALT,
+			PLAY_MUSIC,
+			HALT_MUSIC,
+			MUSIC_VOLUME
+		};
+
+		Type         type;
+		int          voice;   // Music volume for MUSIC_VOLUME.
+		unsigned     serial;
+		const float* samples;
+		unsigned     size;
+		int          loops;
+		float        gain;
+		lair::uint64 startTime;
+		Mix_Music*   music;
+	};
+
+	typedef SpscQueue<Command, MIXER_QUEUE_SIZE> CommandQueue;
+
+protected:
+	bool push(const Command& command);
+	bool flushPending();
+	void execCommands(lair::uint64 callbackTime);
+
+	static void postMix(void* mixer, Uint8* stream, int len);
+	void mix(float* out, unsigned size);
+
+protected:
+	bool     _open;
+	int      _frequency;
+	int      _nChannels;
+
+	// Created by open(), so that the audio callback does not allocate.
+	Tracer::ThreadBuffer*
+	         _traceBuffer;
+
+	CommandQueue _commands;
+
+	// Game thread side: serial of the last play, or 0 once halted.
+	unsigned _serials[MIXER_MAX_VOICES];
+	unsigned _nextSerial;
+	unsigned _nPushed;
+	unsigned _nDropped;
+
+	// Issued while the queue was full, pushed in this order before any other
+	// command. The serial of a pending halt is 0 if there is none.
+	unsigned _pendingHalts[MIXER_MAX_VOICES];
+	unsigned _nPendingHalts;
+	bool     _hasPendingMusic;
+	Command  _pendingMusic;
+	bool     _hasPendingVolume;
+	int      _pendingVolume;
+
+	// Audio thread side.
+	Voice    _voices[MIXER_MAX_VOICES];
+	std::atomic<unsigned>
+	         _finished[MIXER_MAX_VOICES];
+	std::atomic<unsigned>
+	         _startSerials[MIXER_MAX_VOICES];
+	std::atomic<lair::uint64>
+	         _startTimes[MIXER_MAX_VOICES];
+	std::atomic<unsigned>
+	         _nExecuted;
+};
+
+
+#endif
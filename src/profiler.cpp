@@ -0,0 +1,177 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifdef AHIE_PROFILER
+
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include "font.h"
+
+#include "profiler.h"
+
+
+static const char* zoneNames[Profiler::N_ZONES] = {
+    "  layout",
+    "  anims",
+    "  world transform",
+    "  sprites",
+    "  texts",
+    "  batch",
+};
+
+static const FrameStats::Section zoneSections[Profiler::N_ZONES] = {
+    FrameStats::TICKS,
+    FrameStats::TICKS,
+    FrameStats::TICKS,
+    FrameStats::BUILD,
+    FrameStats::BUILD,
+    FrameStats::DRAW,
+};
+
+static const char* sectionNames[FrameStats::N_SECTIONS] = {
+    "ticks",
+    "uploads",
+    "build",
+    "draw",
+    "swap",
+};
+
+
+Profiler::Profiler(SysModule* sys)
+    : _sys(sys),
+      _visible(false),
+      _nFrames(0),
+      _gpuSum(0),
+      _gpuCount(0),
+      _gpuAvg(-1),
+      _frame() {
+	std::memset(_stats, 0, sizeof(_stats));
+}
+
+
+bool Profiler::isVisible() const {
+	return _visible;
+}
+
+
+void Profiler::setVisible(bool visible) {
+	_visible = visible;
+}
+
+
+uint64 Profiler::now() const {
+	return _sys->getTimeNs();
+}
+
+
+void Profiler::addCpu(Zone zone, uint64 time) {
+	_stats[zone].cpu += time;
+}
+
+
+void Profiler::frameEnded(const FrameStats::Frame& frame) {
+	for(int section = 0; section < FrameStats::N_SECTIONS; ++section) {
+		_stats[N_ZONES + section].cpu = frame.sections[section];
+	}
+	if(frame.gpu) {
+		_gpuSum += frame.gpu;
+		++_gpuCount;
+	}
+
+	for(Stats& stats: _stats) {
+		stats.cpuSum += stats.cpu;
+		stats.cpuMax  = std::max(stats.cpuMax, stats.cpu);
+		stats.cpu     = 0;
+	}
+
+	if(++_nFrames == PROFILER_AVERAGE_FRAMES) {
+		for(Stats& stats: _stats) {
+			stats.cpuAvg  = stats.cpuSum / 1000000.f / _nFrames;
+			stats.cpuPeak = stats.cpuMax / 1000000.f;
+			stats.cpuSum  = 0;
+			stats.cpuMax  = 0;
+		}
+		_gpuAvg   = _gpuCount? _gpuSum / 1000000.f / _gpuCount: -1;
+		_gpuSum   = 0;
+		_gpuCount = 0;
+		_nFrames  = 0;
+	}
+}
+
+
+void Profiler::render(Renderer* renderer, Font* font, Sprite* frameBg,
+                      const Vector3& position, const std::string& extra) {
+	if(!_visible || !font || !frameBg) {
+		return;
+	}
+
+	std::string text = "zone: cpu avg/max, gpu (ms)\n";
+	for(int section = 0; section < FrameStats::N_SECTIONS; ++section) {
+		addLine(&text, N_ZONES + section, sectionNames[section]);
+		for(int zone = 0; zone < N_ZONES; ++zone) {
+			if(zoneSections[zone] == section) {
+				addLine(&text, zone, zoneNames[zone]);
+			}
+		}
+	}
+	text += extra;
+
+	float margin  = 16;
+	float width   = 0;
+	unsigned nLines = 0;
+	unsigned start  = 0;
+	for(unsigned i = 0; i < text.size(); ++i) {
+		if(text[i] == '\n') {
+			width = std::max(width, float(font->textWidth(text.substr(start, i - start))));
+			start = i + 1;
+			++nLines;
+		}
+	}
+	float height = font->height() * nLines;
+
+	_frame.background = frameBg;
+	_frame.size       = Vector2(width + 2 * margin, height + 2 * margin);
+	_frame.position   = position - Vector3(0, _frame.size.y(), 0);
+	_frame.render(renderer);
+
+	font->render(renderer, position + Vector3(margin, -margin - float(font->height()), .01),
+	             Vector4(1, 1, 1, 1), text);
+}
+
+
+// The GPU time goes with the draw calls.
+void Profiler::addLine(std::string* text, int row, const char* name) const {
+	const Stats& stats = _stats[row];
+	char line[128];
+	if(row == N_ZONES + FrameStats::DRAW && _gpuAvg >= 0) {
+		std::snprintf(line, sizeof(line), "%s: %.2f/%.2f, %.2f\n", name,
+		              stats.cpuAvg, stats.cpuPeak, _gpuAvg);
+	} else {
+		std::snprintf(line, sizeof(line), "%s: %.2f/%.2f\n", name,
+		              stats.cpuAvg, stats.cpuPeak);
+	}
+	*text += line;
+}
+
+
+#endif
@@ -0,0 +1,150 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_PROFILER_H
+#define _AHIE_PROFILER_H
+
+
+// Zones compile out completely unless AHIE_PROFILER is defined (see
+// CMakeLists.txt; it is only on in debug builds).
+#ifdef AHIE_PROFILER
+#define AHIE_PROFILE_CAT2(a, b) a ## b
+#define AHIE_PROFILE_CAT(a, b) AHIE_PROFILE_CAT2(a, b)
+/// Times the rest of the enclosing scope on the CPU.
+#define PROFILE_ZONE(profiler, zone) \
+	ProfileScope AHIE_PROFILE_CAT(_profileScope, __LINE__)((profiler), Profiler::zone)
+#else
+#define PROFILE_ZONE(profiler, zone)
+#endif
+
+
+#ifdef AHIE_PROFILER
+
+
+#include <lair/core/lair.h>
+
+#include <lair/sys_sdl2/sys_module.h>
+
+#include <lair/render_gl2/renderer.h>
+
+#include "frame.h"
+#include "frame_stats.h"
+
+
+#define PROFILER_AVERAGE_FRAMES 30
+
+
+using namespace lair;
+
+
+class Font;
+
+
+/// Overlay of the frame sections recorded by FrameStats, with the GPU time
+/// of the draw calls, and of the zones inside these sections.
+///
+/// The sections are not timed again: frameEnded() takes the last frame of
+/// FrameStats. Times are averaged over PROFILER_AVERAGE_FRAMES frames.
+class Profiler {
+public:
+	/// Parts of the FrameStats sections, shown under them.
+	enum Zone {
+		LAYOUT,          // Ticks.
+		ANIMS,
+		WORLD_TRANSFORM,
+		SPRITES,         // Build.
+		TEXTS,
+		BATCH,           // Draw.
+		N_ZONES
+	};
+
+public:
+	Profiler(SysModule* sys);
+	Profiler(const Profiler&) = delete;
+	~Profiler() = default;
+
+	Profiler& operator=(const Profiler&) = delete;
+
+	bool isVisible() const;
+	void setVisible(bool visible);
+
+	uint64 now() const;
+	void addCpu(Zone zone, uint64 time);
+	void frameEnded(const FrameStats::Frame& frame);
+
+	/// Draws the overlay in the main batch, top-left corner at position.
+	/// extra lines are appended to the zones.
+	void render(Renderer* renderer, Font* font, Sprite* frameBg,
+	            const Vector3& position, const std::string& extra = std::string());
+
+protected:
+	// Zones first, then the sections of FrameStats.
+	enum {
+		N_ROWS = N_ZONES + FrameStats::N_SECTIONS
+	};
+
+	struct Stats {
+		uint64 cpu;      // This frame.
+		uint64 cpuSum;   // Over the averaging period.
+		uint64 cpuMax;
+		float  cpuAvg;   // Last period, ms.
+		float  cpuPeak;
+	};
+
+protected:
+	void addLine(std::string* text, int row, const char* name) const;
+
+protected:
+	SysModule* _sys;
+	bool       _visible;
+	Stats      _stats[N_ROWS];
+	unsigned   _nFrames;
+
+	uint64     _gpuSum;
+	unsigned   _gpuCount;
+	float      _gpuAvg;  // Negative if unavailable.
+
+	Frame      _frame;
+};
+
+
+class ProfileScope {
+public:
+	inline ProfileScope(Profiler* profiler, Profiler::Zone zone)
+	    : _profiler(profiler),
+	      _zone(zone),
+	      _start(profiler->now()) {
+	}
+
+	inline ~ProfileScope() {
+		_profiler->addCpu(_zone, _profiler->now() - _start);
+	}
+
+private:
+	Profiler*      _profiler;
+	Profiler::Zone _zone;
+	uint64         _start;
+};
+
+
+#endif
+
+
+#endif
@@ -0,0 +1,189 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <lair/render_gl2/renderer.h>
+
+#include "texture_manager.h"
+#include "trace.h"
+
+#include "render_stats.h"
+
+
+RenderStats::RenderStats(TextureManager* textures)
+    : _textures(textures),
+      _sources(),
+      _sourceVertices(),
+      _peakVertices(),
+      _unnamed(),
+      _unnamedVertices(0),
+      _peakUnnamedVertices(0),
+      _resident(),
+      _nFrames(0),
+      _lastUploadedBytes(0) {
+	std::memset(&_current, 0, sizeof(_current));
+	std::memset(&_last,    0, sizeof(_last));
+	std::memset(&_peak,    0, sizeof(_peak));
+}
+
+
+void RenderStats::addSource(Texture* texture, const char* name) {
+	if(!texture) {
+		return;
+	}
+	for(const Source& source: _sources) {
+		if(source.texture == texture) {
+			return;
+		}
+	}
+	_sources.push_back(Source{ texture, name });
+	_sourceVertices.push_back(0);
+	_peakVertices.push_back(0);
+}
+
+
+void RenderStats::countBatch(Renderer* renderer) {
+	Batch& batch = renderer->mainBatch();
+	std::fill(_sourceVertices.begin(), _sourceVertices.end(), 0);
+	_unnamedVertices = 0;
+
+	_resident.clear();
+	_textures->residentTextures(&_resident);
+	for(Texture* texture: _resident) {
+		unsigned vertices = batch.getBuffer(renderer->spriteShader()->program(),
+		                                    texture, renderer->spriteFormat()).vertexCount();
+		if(!vertices) {
+			continue;
+		}
+
+		unsigned source = 0;
+		while(source < _sources.size() && _sources[source].texture != texture) {
+			++source;
+		}
+		if(source < _sources.size()) {
+			_sourceVertices[source] = vertices;
+		} else {
+			_unnamedVertices += vertices;
+			if(std::find(_unnamed.begin(), _unnamed.end(), texture) == _unnamed.end()) {
+				_unnamed.push_back(texture);
+			}
+		}
+
+		unsigned indices = vertices / 4 * 6;
+		++_current.drawCalls;
+		++_current.textureBinds;
+		_current.vertices    += vertices;
+		_current.indices     += indices;
+		_current.vertexBytes += uint64(vertices) * sizeof(SpriteVertex)
+		                      + uint64(indices)  * sizeof(GLuint);
+	}
+
+	for(unsigned i = 0; i < _sources.size(); ++i) {
+		_peakVertices[i] = std::max(_peakVertices[i], _sourceVertices[i]);
+	}
+	_peakUnnamedVertices = std::max(_peakUnnamedVertices, _unnamedVertices);
+	// The sprite shader is bound once per frame.
+	_current.stateChanges = _current.textureBinds + 1;
+}
+
+
+void RenderStats::frameEnded() {
+	uint64 uploaded = _textures->uploadedBytes();
+	_current.textureBytes = uploaded - _lastUploadedBytes;
+	_lastUploadedBytes    = uploaded;
+
+	_last = _current;
+	_peak.drawCalls    = std::max(_peak.drawCalls,    _last.drawCalls);
+	_peak.textureBinds = std::max(_peak.textureBinds, _last.textureBinds);
+	_peak.stateChanges = std::max(_peak.stateChanges, _last.stateChanges);
+	_peak.vertices     = std::max(_peak.vertices,     _last.vertices);
+	_peak.indices      = std::max(_peak.indices,      _last.indices);
+	_peak.vertexBytes  = std::max(_peak.vertexBytes,  _last.vertexBytes);
+	_peak.textureBytes = std::max(_peak.textureBytes, _last.textureBytes);
+	++_nFrames;
+
+	TRACE_COUNTER("draw calls", _last.drawCalls);
+	TRACE_COUNTER("vertices",   _last.vertices);
+
+	std::memset(&_current, 0, sizeof(_current));
+}
+
+
+const RenderStats::Counters& RenderStats::lastFrame() const {
+	return _last;
+}
+
+
+const RenderStats::Counters& RenderStats::peak() const {
+	return _peak;
+}
+
+
+uint64 RenderStats::nFrames() const {
+	return _nFrames;
+}
+
+
+std::string RenderStats::summary() const {
+	char text[256];
+	std::snprintf(text, sizeof(text),
+	              "draw calls: %u, state changes: %u\n"
+	              "vertices: %u, indices: %u\n"
+	              "streamed: %.1f KiB, uploads: %.1f KiB\n",
+	              _last.drawCalls, _last.stateChanges, _last.vertices, _last.indices,
+	              _last.vertexBytes / 1024., _last.textureBytes / 1024.);
+	return text;
+}
+
+
+void RenderStats::report(Logger& log) const {
+	if(!_nFrames) {
+		return;
+	}
+
+	log.info("Render stats, last frame (peak over ", _nFrames, " frames):");
+	log.info("  draw calls: ",    _last.drawCalls,    " (", _peak.drawCalls,    ")");
+	log.info("  texture binds: ", _last.textureBinds, " (", _peak.textureBinds, ")");
+	log.info("  state changes: ", _last.stateChanges, " (", _peak.stateChanges, ")");
+	log.info("  vertices: ",      _last.vertices,     " (", _peak.vertices,     ")");
+	log.info("  indices: ",       _last.indices,      " (", _peak.indices,      ")");
+	log.info("  streamed: ",      _last.vertexBytes >> 10, " KiB (", _peak.vertexBytes >> 10, " KiB)");
+	log.info("  texture uploads: ", _peak.textureBytes >> 10, " KiB peak");
+	for(unsigned i = 0; i < _sources.size(); ++i) {
+		log.info("  ", _sources[i].name, ": ", _sourceVertices[i] / 4, " quads (",
+		         _peakVertices[i] / 4, ")");
+	}
+
+	if(!_unnamed.empty()) {
+		log.info("  other: ", _unnamedVertices / 4, " quads (", _peakUnnamedVertices / 4, ")");
+		for(const Texture* texture: _unnamed) {
+			std::string file = "evicted texture";
+			for(const TextureManager::TextureInfo& info: _textures->residency()) {
+				if(info.texture == texture) {
+					file = info.variant;
+				}
+			}
+			log.warning("  ", file, " was drawn but has no render stats source");
+		}
+	}
+}
@@ -0,0 +1,108 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_RENDER_STATS_H
+#define _AHIE_RENDER_STATS_H
+
+
+#include <string>
+#include <vector>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+
+
+using namespace lair;
+
+
+namespace lair {
+class Texture;
+class Renderer;
+}
+
+class TextureManager;
+
+
+/// Per-frame counters of what the main batch submits.
+///
+/// The batch has one vertex buffer per texture and issues one draw call (and
+/// one texture bind) per non-empty buffer, so the counters are read from the
+/// buffers of all the resident textures, just before the batch is rendered.
+/// Textures that are not resident can not be drawn and are not looked up, so
+/// no buffer is created for them. All geometry is made of quads.
+///
+/// Sources only name the textures in the report; drawn textures without a
+/// source are counted as "other" and reported with a warning.
+class RenderStats {
+public:
+	struct Source {
+		Texture*    texture;
+		const char* name;
+	};
+	typedef std::vector<Source> SourceList;
+
+	struct Counters {
+		unsigned drawCalls;
+		unsigned textureBinds;
+		unsigned stateChanges;  // Shader and texture binds.
+		unsigned vertices;
+		unsigned indices;
+		uint64   vertexBytes;   // Vertices and indices streamed to the GPU.
+		uint64   textureBytes;  // Texture uploads.
+	};
+
+public:
+	RenderStats(TextureManager* textures);
+
+	/// Names a texture drawn by the state in the report.
+	void addSource(Texture* texture, const char* name);
+
+	/// Call after the batch is filled, before it is rendered.
+	void countBatch(Renderer* renderer);
+	void frameEnded();
+
+	const Counters& lastFrame() const;
+	const Counters& peak() const;
+	uint64 nFrames() const;
+
+	/// A few lines for the profiler overlay.
+	std::string summary() const;
+	void report(Logger& log) const;
+
+protected:
+	TextureManager*       _textures;
+	SourceList            _sources;
+	std::vector<unsigned> _sourceVertices;  // Last frame, per source.
+	std::vector<unsigned> _peakVertices;
+	std::vector<const Texture*>
+	                      _unnamed;         // Drawn textures without a source.
+	unsigned              _unnamedVertices;
+	unsigned              _peakUnnamedVertices;
+	std::vector<Texture*> _resident;        // Scratch buffer of countBatch().
+
+	Counters              _current;
+	Counters              _last;
+	Counters              _peak;
+	uint64                _nFrames;
+	uint64                _lastUploadedBytes;
+};
+
+
+#endif
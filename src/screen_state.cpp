@@ -34,7 +34,11 @@ ScreenState::ScreenState(Game* game)
 	: _game(game),
       _entities(_game->log()),
       _sprites(_game->renderer()),
-      _running(false) {
+      _renderStats(_game->textures()),
+      _running(false),
+      _waitingForMain(false),
+      _bgFile(),
+      _nextBgFile() {
 }
 
 
@@ -55,35 +59,68 @@ void ScreenState::initialize() {
 
 
 void ScreenState::shutdown() {
-
+	_renderStats.report(_game->log());
 }
 
 
 void ScreenState::run() {
 	_running = true;
+	_waitingForMain = false;
+
+	// The first frame must show something: finish the background now, the
+	// rest of the assets keep loading in the background.
+	if(_bgFile.empty() && !_nextBgFile.empty()) {
+		_game->textures()->load(_nextBgFile, SCREEN_TEXTURE_FLAGS);
+		updateBg();
+	}
 
+	bool titleShown = false;
 	while(_running) {
-		_game->sys()->waitAndDispatchSystemEvents();
+		bool mainLoaded = _game->mainState()->updateLoading();
+		if(!mainLoaded || _game->textures()->isLoading()) {
+			_game->sys()->dispatchPendingSystemEvents();
+		} else {
+			_game->sys()->waitAndDispatchSystemEvents();
+		}
 		if(_game->sys()->getKeyState(SDL_SCANCODE_ESCAPE)) {
 			_running = false;
 		}
-		if(_game->sys()->getKeyState(SDL_SCANCODE_LEFT)
-		|| _game->sys()->getKeyState(SDL_SCANCODE_RIGHT)) {
+		if(!_waitingForMain
+		&& (_game->sys()->getKeyState(SDL_SCANCODE_LEFT)
+		 || _game->sys()->getKeyState(SDL_SCANCODE_RIGHT))) {
+			_waitingForMain = true;
+			if(!mainLoaded) {
+				_game->log().info("Waiting for assets (",
+				                  int(_game->mainState()->loadingProgress().progress() * 100),
+				                  "%)...");
+			}
+		}
+		if(_waitingForMain && mainLoaded) {
 			_game->setNextState(_game->mainState());
 			_running = false;
 		}
 
+		_game->updateAssets(TEXTURE_UPLOADS_PER_FRAME);
+		updateBg();
+
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		_game->renderer()->mainBatch().clearBuffers();
 
 		_entities.updateWorldTransform();
 		_sprites.render(0, _camera);
+		_renderStats.countBatch(_game->renderer());
 
 		_game->renderer()->spriteShader()->use();
 		_game->renderer()->spriteShader()->setTextureUnit(0);
 		_game->renderer()->spriteShader()->setViewMatrix(_camera.transform());
 		_game->renderer()->mainBatch().render();
 		_game->window()->swapBuffers();
+		_renderStats.frameEnded();
+
+		if(!titleShown && !_bgFile.empty()) {
+			_game->startup()->addMilestone("title shown");
+			titleShown = true;
+		}
 	}
 }
 
@@ -93,11 +130,39 @@ void ScreenState::quit() {
 }
 
 void ScreenState::setBg(const std::string& bg) {
-	Texture* tex = _game->renderer()->getTexture(
-	            bg, Texture::BILINEAR | Texture::CLAMP);
+	prefetchBg(bg);
+	_nextBgFile = bg;
+	updateBg();
+
+	if(!_nextBgFile.empty()) {
+		// Hide the previous background until the new one is ready.
+		_bg.place(Transform(Translation(Vector3(0, 0, -2))));
+	}
+}
+
+
+void ScreenState::prefetchBg(const std::string& bg) {
+	_game->textures()->prefetch(bg, SCREEN_TEXTURE_FLAGS);
+}
+
+
+void ScreenState::updateBg() {
+	if(_nextBgFile.empty()
+	|| !_game->textures()->isResident(_nextBgFile, SCREEN_TEXTURE_FLAGS)) {
+		return;
+	}
+
+	Texture* tex = _game->textures()->get(_nextBgFile, SCREEN_TEXTURE_FLAGS);
 	_sprite.reset(new Sprite(tex));
+	_renderStats.addSource(tex, "screen");
 
 	_bg.sprite()->setSprite(_sprite.get());
 	float s = float(_game->window()->height()) / tex->height();
 	_bg.place(Transform(Eigen::Scaling(s, s, 1.f)));
+
+	if(!_bgFile.empty() && _bgFile != _nextBgFile) {
+		_game->textures()->evict(_bgFile, SCREEN_TEXTURE_FLAGS);
+	}
+	_bgFile = _nextBgFile;
+	_nextBgFile.clear();
 }
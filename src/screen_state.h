@@ -30,9 +30,13 @@
 #include <lair/ec/entity_manager.h>
 #include <lair/ec/sprite_component.h>
 
+#include "render_stats.h"
 #include "game_state.h"
 
 
+#define SCREEN_TEXTURE_FLAGS (Texture::BILINEAR | Texture::CLAMP)
+
+
 using namespace lair;
 
 
@@ -49,18 +53,26 @@ public:
 	virtual void quit();
 
 	void setBg(const std::string& bg);
+	void prefetchBg(const std::string& bg);
+
+protected:
+	void updateBg();
 
 protected:
 	Game* _game;
 
 	EntityManager _entities;
 	SpriteComponentManager _sprites;
+	RenderStats _renderStats;
 
 	bool _running;
+	bool _waitingForMain;
 	OrthographicCamera _camera;
 	std::unique_ptr<Sprite> _sprite;
 
 	EntityRef _bg;
+	std::string _bgFile;
+	std::string _nextBgFile;
 };
 
 
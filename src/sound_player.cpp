@@ -19,14 +19,63 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <algorithm>
 
 #include <SDL_mixer.h>
 
 #include "game.h"
+#include "trace.h"
 
 #include "sound_player.h"
 
 
+static_assert(SOUNDPLAYER_MAX_CHANNELS <= MIXER_MAX_VOICES,
+              "Mixer must have a voice per channel");
+
+
+// Chunks and musics to free on a worker: freeing them takes the audio lock.
+// What the task did not free (e.g. if the pool discarded it) is freed by the
+// destructor.
+struct AudioFreeList {
+	std::vector<Mix_Chunk*> chunks;
+	std::vector<Mix_Music*> musics;
+
+	~AudioFreeList() {
+		free();
+	}
+
+	void free() {
+		for(Mix_Chunk* chunk: chunks) {
+			Mix_FreeChunk(chunk);
+		}
+		for(Mix_Music* music: musics) {
+			Mix_FreeMusic(music);
+		}
+		chunks.clear();
+		musics.clear();
+	}
+};
+
+
+Sound::Sound()
+    : chunk(nullptr),
+      volume(SOUNDPLAYER_DEFAULT_VOLUME),
+      name(),
+      useCount(0),
+      loading(false),
+      data(),
+      pcmBytes(0),
+      lastUse(0),
+      priority(SOUND_PRIORITY_NORMAL),
+      maxInstances(SOUNDPLAYER_MAX_CHANNELS),
+      minInterval(0),
+      lastPlayTime(0),
+      playPending(false),
+      pendingLoops(0),
+      pendingTime(0) {
+}
+
+
 Sound::~Sound() {
 	if(chunk) {
 		Mix_FreeChunk(chunk);
@@ -34,6 +83,19 @@ Sound::~Sound() {
 }
 
 
+bool Sound::isReady() const {
+	return chunk.load(std::memory_order_acquire);
+}
+
+
+Music::Music()
+    : track(nullptr),
+      name(),
+      useCount(0),
+      loading(false) {
+}
+
+
 Music::~Music() {
 	if(track) {
 		Mix_FreeMusic(track);
@@ -41,82 +103,206 @@ Music::~Music() {
 }
 
 
+bool Music::isReady() const {
+	return track.load(std::memory_order_acquire);
+}
+
+
 SoundPlayer::SoundPlayer(Game* game)
 	: _game(game),
+	  _sounds(),
+	  _freeHandles(),
 	  _soundMap(),
-	  _musicMap() {
+	  _musicMap(),
+	  _pcmBudget(SOUNDPLAYER_PCM_BUDGET),
+	  _pcmBytes(0),
+	  _compressedBytes(0),
+	  _mixer(),
+	  _pendingFrees(),
+	  _pendingMusic(nullptr) {
+	for(Voice& voice: _voices) {
+		voice.sound     = nullptr;
+		voice.priority  = SOUND_PRIORITY_LOW;
+		voice.startTime = 0;
+	}
 }
 
 
-const Sound* SoundPlayer::loadSound(const lair::Path& filename) {
-	auto it = _soundMap.find(filename);
-	if(it == _soundMap.end()) {
-		Sound snd;
+SoundPlayer::~SoundPlayer() {
+	// Once the post-mix hook is removed, the audio thread reads no chunk.
+	_mixer.reset();
+	for(const PendingFree& pending: _pendingFrees) {
+		if(pending.chunk) {
+			Mix_FreeChunk(pending.chunk);
+		} else {
+			Mix_FreeMusic(pending.music);
+		}
+	}
+}
 
-		_game->log().log("Load sound \"", filename, "\"...");
 
-		snd.chunk = Mix_LoadWAV(filename.utf8CStr());
-		if(!snd.chunk) {
-			_game->log().error("Failed to load sound: ", Mix_GetError());
-			return nullptr;
-		}
+bool SoundPlayer::enableMixer() {
+	std::unique_ptr<Mixer> mixer(new Mixer);
+	if(!mixer->open()) {
+		_game->log().warning("Audio device does not use float samples, falling back to SDL_mixer channels");
+		return false;
+	}
+	_game->log().info("Sound effect mixer: ", mixer->frequency(), " Hz, ",
+	                  mixer->nChannels(), " channels");
+	_mixer = std::move(mixer);
+	return true;
+}
 
-		snd.volume = SOUNDPLAYER_DEFAULT_VOLUME;
-		Mix_VolumeChunk(snd.chunk, snd.volume);
-		snd.name = filename;
-		snd.useCount = 0;
 
-		auto res = _soundMap.emplace(filename, snd);
-		assert(res.second);
-		it = res.first;
+void SoundPlayer::update() {
+	if(!_mixer) {
+		return;
+	}
+	_mixer->flush();
+
+	std::shared_ptr<AudioFreeList> frees;
+	for(unsigned i = 0; i < _pendingFrees.size(); ) {
+		const PendingFree& pending = _pendingFrees[i];
+		if(_mixer->isReached(pending.fence)) {
+			if(!frees) {
+				frees = std::make_shared<AudioFreeList>();
+			}
+			if(pending.chunk) {
+				frees->chunks.push_back(pending.chunk);
+			} else {
+				frees->musics.push_back(pending.music);
+			}
+			_pendingFrees[i] = _pendingFrees.back();
+			_pendingFrees.pop_back();
+		} else {
+			++i;
+		}
+	}
 
-		// Do not destroy the chunk when snd goes out of scope
-		snd.chunk = nullptr;
+	if(frees) {
+		_game->tasks()->enqueue([frees] {
+			TRACE_SCOPE("freeAudio");
+			frees->free();
+		});
 	}
+}
 
-	++(it->second.useCount);
 
-	return &(it->second);
+size_t SoundPlayer::pcmBudget() const {
+	return _pcmBudget;
 }
 
 
-const Music* SoundPlayer::loadMusic(const lair::Path& filename) {
-	auto it = _musicMap.find(filename);
-	if(it == _musicMap.end()) {
-		Music mus;
+void SoundPlayer::setPcmBudget(size_t bytes) {
+	_pcmBudget = bytes;
+	trimPcm(nullptr);
+}
 
-		_game->log().log("Load music \"", filename, "\"...");
 
-		mus.track = Mix_LoadMUS(filename.utf8CStr());
-		if(!mus.track) {
-			_game->log().error("Failed to load music: ", Mix_GetError());
-			return nullptr;
+size_t SoundPlayer::compressedBytes() const {
+	return _compressedBytes;
+}
+
+
+size_t SoundPlayer::pcmBytes() const {
+	return _pcmBytes;
+}
+
+
+void SoundPlayer::logResidency() {
+	_game->log().info("Sound residency:");
+	for(const std::unique_ptr<Sound>& snd: _sounds) {
+		if(snd) {
+			_game->log().info("  ", snd->name, ": ",
+			                  (snd->data? snd->data->size(): 0) >> 10, " KiB compressed, ",
+			                  snd->pcmBytes >> 10, " KiB decoded");
 		}
-		mus.name = filename;
-		mus.useCount = 0;
+	}
+	_game->log().info("  total: ", _compressedBytes >> 10, " KiB compressed, ",
+	                  _pcmBytes >> 10, " / ", _pcmBudget >> 10, " KiB decoded");
+	if(_mixer && _mixer->nDropped()) {
+		_game->log().warning("  ", _mixer->nDropped(), " sounds dropped on a full mixer queue");
+	}
+}
 
-		auto res = _musicMap.emplace(filename, mus);
-		assert(res.second);
-		it = res.first;
 
-		// Do not destroy the track when mus goes out of scope
-		mus.track = nullptr;
+SoundHandle SoundPlayer::loadSoundAsync(const lair::Path& file) {
+	auto it = _soundMap.find(file);
+	if(it != _soundMap.end()) {
+		++sound(it->second)->useCount;
+		return it->second;
 	}
 
-	++(it->second.useCount);
+	_game->log().log("Load sound \"", file, "\" in background...");
 
-	return &(it->second);
+	SoundHandle handle = newSound(file);
+	decodeAsync(handle);
+	return handle;
 }
 
 
-void SoundPlayer::releaseSound(const Sound* sound) {
-	auto it = _soundMap.find(sound->name);
-	assert(it != _soundMap.end());
+// The music streams from its SDL_RWops for as long as it exists.
+const Music* SoundPlayer::loadMusicAsync(const lair::Path& file) {
+	auto it = _musicMap.find(file);
+	if(it != _musicMap.end()) {
+		++(it->second.useCount);
+		return &(it->second);
+	}
 
-	--(it->second.useCount);
-	if(!it->second.useCount) {
-		_game->log().log("Release sound \"", it->second.name, "\"...");
-		_soundMap.erase(it);
+	_game->log().log("Load music \"", file, "\" in background...");
+
+	Music* music = newMusic(file);
+	music->loading = true;
+	_game->tasks()->enqueue([this, music, file] {
+		TRACE_SCOPE_DETAIL("decodeMusic", file.utf8CStr());
+		StartupReport* startup = _game->startup();
+		uint64 start = Tracer::now();
+		SDL_RWops* rw = _game->assets()->open(file.utf8CStr());
+		uint64 openEnd = Tracer::now();
+		startup->addAssetStep(file.utf8CStr(), "music", StartupReport::IO, start, openEnd);
+		// Streamed: only the header is decoded here.
+		Mix_Music* track = rw? Mix_LoadMUS_RW(rw, 1): nullptr;
+		startup->addAssetStep(file.utf8CStr(), nullptr, StartupReport::DECODE,
+		                      openEnd, Tracer::now());
+		std::string error = track? "": Mix_GetError();
+		if(track) {
+			music->track.store(track, std::memory_order_release);
+		}
+
+		_game->tasks()->post([this, music, error] {
+			musicLoaded(music, error);
+		});
+	});
+	return music;
+}
+
+
+bool SoundPlayer::isReady(SoundHandle handle) const {
+	Sound* snd = sound(handle);
+	return snd && snd->isReady();
+}
+
+
+void SoundPlayer::setPolicy(SoundHandle handle, int priority, unsigned maxInstances,
+                            float minInterval) {
+	Sound* snd = sound(handle);
+	if(!snd) {
+		return;
+	}
+	snd->priority     = priority;
+	snd->maxInstances = std::max(maxInstances, 1u);
+	snd->minInterval  = minInterval * 1000000000.f;
+}
+
+
+void SoundPlayer::releaseSound(SoundHandle handle) {
+	Sound* snd = sound(handle);
+	assert(snd);
+
+	--snd->useCount;
+	// A sound being decoded is erased once the worker is done with it.
+	if(!snd->useCount && !snd->loading) {
+		eraseSound(handle);
 	}
 }
 
@@ -125,36 +311,408 @@ void SoundPlayer::releaseMusic(const Music* music) {
 	auto it = _musicMap.find(music->name);
 	assert(it != _musicMap.end());
 
+	if(_pendingMusic == music) {
+		_pendingMusic = nullptr;
+	}
+
 	--(it->second.useCount);
-	if(!it->second.useCount) {
+	if(!it->second.useCount && !it->second.loading) {
 		_game->log().log("Release music \"", it->second.name, "\"...");
+		freeMusic(it->second.track.exchange(nullptr, std::memory_order_acq_rel));
 		_musicMap.erase(it);
 	}
 }
 
 
-int SoundPlayer::playSound(const Sound* sound, int loops) {
-	return sound->chunk ? Mix_PlayChannel(-1, sound->chunk, loops) : -1;
+int SoundPlayer::playSound(SoundHandle handle, int loops) {
+	return playSoundAt(handle, loops, _game->sys()->getTimeNs());
+}
+
+
+int SoundPlayer::playSoundAt(SoundHandle handle, int loops, uint64 time) {
+	Sound* snd = sound(handle);
+	Mix_Chunk* chunk = snd? snd->chunk.load(std::memory_order_acquire): nullptr;
+	if(!chunk) {
+		// Evicted: play it once decoded again.
+		if(snd && snd->data) {
+			snd->playPending  = true;
+			snd->pendingLoops = loops;
+			snd->pendingTime  = time;
+			if(!snd->loading) {
+				decodeAsync(handle);
+			}
+		}
+		return -1;
+	}
+
+	snd->lastUse = _game->sys()->getTimeNs();
+	if(snd->lastPlayTime && time >= snd->lastPlayTime
+	&& time - snd->lastPlayTime < snd->minInterval) {
+		return -1;
+	}
+
+	int channel = allocateVoice(snd);
+	if(channel < 0) {
+		return -1;
+	}
+
+	channel = startChannel(channel, snd, chunk, loops, time);
+	if(channel >= 0) {
+		Voice& voice = _voices[channel];
+		voice.sound     = snd;
+		voice.priority  = snd->priority;
+		voice.startTime = time;
+		snd->lastPlayTime = time;
+	}
+	return channel;
 }
 
 
 void SoundPlayer::playMusic(const Music* music) {
-	if(music->track) {
-		Mix_PlayMusic(music->track, -1);
+	Mix_Music* track = music->track.load(std::memory_order_acquire);
+	if(track) {
+		_pendingMusic = nullptr;
+		if(_mixer) {
+			_mixer->playMusic(track, -1);
+		} else {
+			Mix_PlayMusic(track, -1);
+		}
+	} else if(music->loading) {
+		_pendingMusic = music;
 	}
 }
 
 
 void SoundPlayer::haltSound(int channel) {
-	if(channel != -1) { Mix_HaltChannel(channel); }
+	if(channel != -1) { haltChannel(channel); }
+}
+
+
+bool SoundPlayer::soundStartTime(int channel, uint64* time) const {
+	uint64 mixerTime;
+	if(!_mixer || channel < 0 || !_mixer->startTime(channel, &mixerTime)) {
+		return false;
+	}
+	// Move the timestamp back to the sys clock.
+	int64 age = int64(Mixer::now() - mixerTime);
+	*time = _game->sys()->getTimeNs() - age;
+	return true;
 }
 
 
 void SoundPlayer::haltMusic() {
-	Mix_HaltMusic();
+	_pendingMusic = nullptr;
+	if(_mixer) {
+		_mixer->haltMusic();
+	} else {
+		Mix_HaltMusic();
+	}
 }
 
 
 void SoundPlayer::setMusicVolume(float volume) {
-	Mix_VolumeMusic(128 * volume);
+	if(_mixer) {
+		_mixer->setMusicVolume(128 * volume);
+	} else {
+		Mix_VolumeMusic(128 * volume);
+	}
+}
+
+
+int SoundPlayer::allocateVoice(const Sound* sound) {
+	int      oldestInstance = -1;
+	unsigned nInstances     = 0;
+	int      free           = -1;
+	int      victim         = -1;
+	for(int channel = 0; channel < SOUNDPLAYER_MAX_CHANNELS; ++channel) {
+		Voice& voice = _voices[channel];
+		if(!voice.sound || !isPlaying(channel)) {
+			voice.sound = nullptr;
+			if(free < 0) {
+				free = channel;
+			}
+			continue;
+		}
+
+		if(voice.sound == sound) {
+			++nInstances;
+			if(oldestInstance < 0 || voice.startTime < _voices[oldestInstance].startTime) {
+				oldestInstance = channel;
+			}
+		}
+
+		if(victim < 0) {
+			victim = channel;
+			continue;
+		}
+		const Voice& v = _voices[victim];
+		if(voice.priority != v.priority) {
+			if(voice.priority < v.priority) {
+				victim = channel;
+			}
+		} else if(voice.startTime < v.startTime) {
+			victim = channel;
+		}
+	}
+
+	if(nInstances >= sound->maxInstances) {
+		haltChannel(oldestInstance);
+		return oldestInstance;
+	}
+	if(free >= 0) {
+		return free;
+	}
+
+	if(_voices[victim].priority > sound->priority) {
+		return -1;
+	}
+	haltChannel(victim);
+	return victim;
+}
+
+
+bool SoundPlayer::isPlaying(int channel) const {
+	return _mixer? _mixer->isPlaying(channel): Mix_Playing(channel);
+}
+
+
+int SoundPlayer::startChannel(int channel, const Sound* sound, Mix_Chunk* chunk, int loops,
+                              uint64 time) {
+	if(_mixer) {
+		// Move the timestamp to the mixer clock.
+		int64  delay     = int64(time - _game->sys()->getTimeNs());
+		uint64 startTime = Mixer::now() + delay;
+		return _mixer->play(channel, chunk, float(sound->volume) / MIX_MAX_VOLUME, loops,
+		                    startTime)?
+		            channel: -1;
+	}
+	// SDL_mixer starts channels at the next buffer.
+	return Mix_PlayChannel(channel, chunk, loops);
+}
+
+
+void SoundPlayer::haltChannel(int channel) {
+	if(_mixer) {
+		_mixer->halt(channel);
+	} else {
+		Mix_HaltChannel(channel);
+	}
+}
+
+
+// The voices playing chunk must already be halted.
+void SoundPlayer::freeChunk(Mix_Chunk* chunk) {
+	if(!chunk) {
+		return;
+	}
+	if(_mixer) {
+		// The audio thread may still read it until the halts are applied.
+		_pendingFrees.push_back(PendingFree{ chunk, nullptr, _mixer->fence() });
+	} else {
+		// SDL_mixer halts the channels that play it, under its lock.
+		Mix_FreeChunk(chunk);
+	}
+}
+
+
+// SDL_mixer halts the music if it is playing.
+void SoundPlayer::freeMusic(Mix_Music* track) {
+	if(!track) {
+		return;
+	}
+	if(_mixer) {
+		// A play command may still be in the queue.
+		_pendingFrees.push_back(PendingFree{ nullptr, track, _mixer->fence() });
+	} else {
+		Mix_FreeMusic(track);
+	}
+}
+
+
+Sound* SoundPlayer::sound(SoundHandle handle) const {
+	return (handle && handle <= _sounds.size())? _sounds[handle - 1].get(): nullptr;
+}
+
+
+SoundHandle SoundPlayer::newSound(const lair::Path& name) {
+	SoundHandle handle;
+	if(!_freeHandles.empty()) {
+		handle = _freeHandles.back();
+		_freeHandles.pop_back();
+	} else {
+		_sounds.emplace_back();
+		handle = _sounds.size();
+	}
+
+	Sound* snd = new Sound;
+	snd->name     = name;
+	snd->useCount = 1;
+	_sounds[handle - 1].reset(snd);
+	_soundMap.emplace(name, handle);
+	return handle;
+}
+
+
+void SoundPlayer::eraseSound(SoundHandle handle) {
+	Sound* snd = sound(handle);
+	_game->log().log("Release sound \"", snd->name, "\"...");
+
+	for(int channel = 0; channel < SOUNDPLAYER_MAX_CHANNELS; ++channel) {
+		if(_voices[channel].sound == snd) {
+			haltChannel(channel);
+			_voices[channel].sound = nullptr;
+		}
+	}
+	freeChunk(snd->chunk.exchange(nullptr, std::memory_order_acq_rel));
+
+	_pcmBytes        -= snd->pcmBytes;
+	_compressedBytes -= snd->data? snd->data->size(): 0;
+
+	_soundMap.erase(snd->name);
+	_sounds[handle - 1].reset();
+	_freeHandles.push_back(handle);
+}
+
+
+Music* SoundPlayer::newMusic(const lair::Path& name) {
+	Music& music = _musicMap[name];
+	music.name     = name;
+	music.useCount = 1;
+	return &music;
+}
+
+
+// The compressed file is read once, then kept to decode the sound again
+// after an eviction.
+void SoundPlayer::decodeAsync(SoundHandle handle) {
+	Sound* snd = sound(handle);
+	snd->loading = true;
+
+	// The Sound object is owned by a unique_ptr, it does not move.
+	DataSP     data = snd->data;
+	lair::Path file = snd->name;
+	_game->tasks()->enqueue([this, handle, snd, data, file] {
+		TRACE_SCOPE_DETAIL("decodeSound", file.utf8CStr());
+		StartupReport* startup = _game->startup();
+		DataSP bytes = data;
+		std::string error;
+		if(!bytes) {
+			uint64 start = Tracer::now();
+			std::shared_ptr<std::string> read = std::make_shared<std::string>();
+			if(_game->assets()->read(file.utf8CStr(), read.get())) {
+				bytes = read;
+			} else {
+				error = "file not found";
+			}
+			startup->addAssetStep(file.utf8CStr(), "sound", StartupReport::IO,
+			                      start, Tracer::now(), read->size());
+		}
+
+		if(bytes) {
+			uint64 start = Tracer::now();
+			SDL_RWops* rw = SDL_RWFromConstMem(bytes->data(), bytes->size());
+			Mix_Chunk* chunk = rw? Mix_LoadWAV_RW(rw, 1): nullptr;
+			startup->addAssetStep(file.utf8CStr(), "sound", StartupReport::DECODE,
+			                      start, Tracer::now(), chunk? chunk->alen: 0);
+			if(chunk) {
+				Mix_VolumeChunk(chunk, snd->volume);
+				snd->chunk.store(chunk, std::memory_order_release);
+			} else {
+				error = Mix_GetError();
+			}
+		}
+
+		_game->tasks()->post([this, handle, bytes, error] {
+			soundDecoded(handle, bytes, error);
+		});
+	});
+}
+
+
+void SoundPlayer::soundDecoded(SoundHandle handle, const DataSP& data,
+                               const std::string& error) {
+	Sound* snd = sound(handle);
+	snd->loading = false;
+	if(!error.empty()) {
+		_game->log().error("Failed to load sound \"", snd->name, "\": ", error);
+	}
+	if(data && !snd->data) {
+		snd->data = data;
+		_compressedBytes += data->size();
+	}
+
+	Mix_Chunk* chunk = snd->chunk.load(std::memory_order_acquire);
+	if(chunk) {
+		snd->pcmBytes = chunk->alen;
+		_pcmBytes += snd->pcmBytes;
+	}
+
+	if(!snd->useCount) {
+		eraseSound(handle);
+		return;
+	}
+
+	uint64 now = _game->sys()->getTimeNs();
+	snd->lastUse = now;
+	trimPcm(snd);
+
+	if(snd->playPending) {
+		snd->playPending = false;
+		if(chunk && now - snd->pendingTime <= SOUNDPLAYER_MAX_PLAY_DELAY) {
+			playSoundAt(handle, snd->pendingLoops, now);
+		}
+	}
+}
+
+
+// Only called on sounds that are not playing. A voice may have been halted
+// without the audio thread knowing yet, so the chunk is freed through
+// freeChunk().
+void SoundPlayer::evictPcm(Sound* snd) {
+	freeChunk(snd->chunk.exchange(nullptr, std::memory_order_acq_rel));
+	_pcmBytes -= snd->pcmBytes;
+	snd->pcmBytes = 0;
+}
+
+
+void SoundPlayer::trimPcm(const Sound* keep) {
+	while(_pcmBytes > _pcmBudget) {
+		Sound* lru = nullptr;
+		for(const std::unique_ptr<Sound>& snd: _sounds) {
+			if(!snd || snd.get() == keep || !snd->pcmBytes || !snd->data
+			|| (lru && snd->lastUse >= lru->lastUse)) {
+				continue;
+			}
+
+			bool playing = false;
+			for(int channel = 0; channel < SOUNDPLAYER_MAX_CHANNELS; ++channel) {
+				playing |= _voices[channel].sound == snd.get() && isPlaying(channel);
+			}
+			if(!playing) {
+				lru = snd.get();
+			}
+		}
+
+		if(!lru) {
+			break;
+		}
+		_game->log().log("Evict decoded sound \"", lru->name, "\"");
+		evictPcm(lru);
+	}
+}
+
+
+void SoundPlayer::musicLoaded(Music* music, const std::string& error) {
+	music->loading = false;
+	if(!error.empty()) {
+		_game->log().error("Failed to load music \"", music->name, "\": ", error);
+	}
+	if(!music->useCount) {
+		freeMusic(music->track.exchange(nullptr, std::memory_order_acq_rel));
+		_musicMap.erase(music->name);
+		return;
+	}
+	if(_pendingMusic == music) {
+		playMusic(music);
+	}
 }
@@ -21,6 +21,9 @@
 #define _UW_SOUND_PLAYER_H_
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
 #include <unordered_map>
 
 #include <SDL_mixer.h>
@@ -28,66 +31,221 @@
 #include <lair/core/lair.h>
 #include <lair/core/path.h>
 
+#include "mixer.h"
+
 
 #define SOUNDPLAYER_MAX_CHANNELS    32
 #define SOUNDPLAYER_DEFAULT_VOLUME  (MIX_MAX_VOLUME / 2)
+#define SOUNDPLAYER_PCM_BUDGET      (32 << 20)
+/// Plays of an evicted sound wait for its decode at most this long (ns).
+#define SOUNDPLAYER_MAX_PLAY_DELAY  250000000ull
+
+#define SOUND_PRIORITY_LOW      0
+#define SOUND_PRIORITY_NORMAL   1
+#define SOUND_PRIORITY_HIGH     2
+/// Critical sounds may steal any voice, so they are never dropped.
+#define SOUND_PRIORITY_CRITICAL 3
 
 
 class Game;
 
 
+/// Identifies a loaded sound. 0 is never a valid handle.
+typedef unsigned SoundHandle;
+
+
+/// A loaded sound. chunk stays null until the sound is decoded; it is
+/// published atomically by the loading thread. data holds the compressed
+/// file, so the decoded chunk can be evicted and decoded again.
 class Sound {
 public:
+	Sound();
+	Sound(const Sound&) = delete;
 	~Sound();
 
+	Sound& operator=(const Sound&) = delete;
+
+	bool isReady() const;
+
 public:
-	Mix_Chunk*   chunk;
+	std::atomic<Mix_Chunk*> chunk;
 	unsigned     volume;
 
 	lair::Path   name;
 	unsigned     useCount;
+	bool         loading;
+
+	std::shared_ptr<const std::string>
+	             data;
+	size_t       pcmBytes;
+	lair::uint64 lastUse;
+
+	// Voice allocation policy, see SoundPlayer::setPolicy().
+	int          priority;
+	unsigned     maxInstances;
+	lair::uint64 minInterval;
+	lair::uint64 lastPlayTime;
+
+	// Play requested while the sound was evicted, see SoundPlayer.
+	bool         playPending;
+	int          pendingLoops;
+	lair::uint64 pendingTime;
 };
 
 
+/// Handle on a music, see Sound.
 class Music {
 public:
+	Music();
+	Music(const Music&) = delete;
 	~Music();
 
+	Music& operator=(const Music&) = delete;
+
+	bool isReady() const;
+
 public:
-	Mix_Music*   track;
+	std::atomic<Mix_Music*> track;
 
 	lair::Path   name;
 	unsigned     useCount;
+	bool         loading;
 };
 
 
+/// Sounds and musics are loaded asynchronously from an asset name (see
+/// AssetFs), so they always come from the asset pack when there is one.
+/// Loads return a handle immediately and decode on the task pool. Sounds are
+/// referred to by integer handles, indices in a table; names are only looked
+/// up when loading.
+///
+/// Playing a sound that is not ready yet does nothing: sound effects are only
+/// meaningful when they are triggered. Playing a music that is not ready
+/// starts it as soon as it is.
+///
+/// Channels are allocated explicitly. A sound is dropped if it is retriggered
+/// faster than its minimum interval. Past its instance cap, it restarts its
+/// oldest instance. When no channel is free, it steals the lowest priority,
+/// then oldest voice, provided that voice does not have a higher priority.
+///
+/// Compressed sounds stay in memory, decoded chunks are a cache: when their
+/// total size exceeds the PCM budget, the least recently played sounds are
+/// evicted. Playing an evicted sound starts decoding it again and plays it
+/// once decoded, unless that takes more than SOUNDPLAYER_MAX_PLAY_DELAY (a
+/// late sound effect is worse than none). Such a play returns -1, as the
+/// channel is not known yet.
+///
+/// Once enableMixer() succeeds, sound effects are played by a Mixer and music
+/// commands go through its queue, so the game thread never takes the audio
+/// lock. Otherwise they go through SDL_mixer directly. With the mixer,
+/// update() hands chunks and musics to a worker thread to be freed (which
+/// takes the audio lock) once the audio thread is done with them.
 class SoundPlayer {
 public:
 	SoundPlayer(Game *game);
+	SoundPlayer(const SoundPlayer&) = delete;
+	~SoundPlayer();
+
+	SoundPlayer& operator=(const SoundPlayer&) = delete;
 
-	const Sound* loadSound(const lair::Path& filename);
-	const Music* loadMusic(const lair::Path& filename);
+	bool enableMixer();
+	/// Frees the chunks and musics released by the audio thread, on a worker.
+	/// Call it once per frame.
+	void update();
 
-	void releaseSound(const Sound* sound);
+	size_t pcmBudget() const;
+	void setPcmBudget(size_t bytes);
+
+	size_t compressedBytes() const;
+	size_t pcmBytes() const;
+	void logResidency();
+
+	SoundHandle loadSoundAsync(const lair::Path& file);
+	const Music* loadMusicAsync(const lair::Path& file);
+
+	bool isReady(SoundHandle handle) const;
+	void setPolicy(SoundHandle handle, int priority, unsigned maxInstances,
+	               float minInterval = 0);
+
+	void releaseSound(SoundHandle handle);
 	void releaseMusic(const Music* music);
 
-	int playSound(const Sound* sound, int loops);
+	int playSound(SoundHandle handle, int loops);
+	/// Plays a sound at time (in the sys()->getTimeNs() clock), typically the
+	/// timestamp of the simulation tick that triggered it. With the mixer, a
+	/// time in the future starts the sound at the matching sample instead of
+	/// at the start of the next buffer; a past time starts it right away.
+	int playSoundAt(SoundHandle handle, int loops, lair::uint64 time);
 	void playMusic(const Music* music);
 
 	void haltSound(int channel);
+	/// Time (sys()->getTimeNs() clock) at which the audio callback started the
+	/// sound last played on channel. Only available with the mixer.
+	bool soundStartTime(int channel, lair::uint64* time) const;
 	void haltMusic();
 
 	void setMusicVolume(float volume);
 
 private:
-	typedef std::unordered_map<lair::Path, Sound> SoundMap;
+	struct Voice {
+		const Sound* sound;
+		int          priority;
+		lair::uint64 startTime;
+	};
+
+	// Either a chunk or a music.
+	struct PendingFree {
+		Mix_Chunk* chunk;
+		Mix_Music* music;
+		unsigned   fence;
+	};
+
+	typedef std::shared_ptr<const std::string> DataSP;
+	typedef std::vector<std::unique_ptr<Sound>> SoundTable;
+	typedef std::unordered_map<lair::Path, SoundHandle> SoundMap;
 	typedef std::unordered_map<lair::Path, Music> MusicMap;
 
 private:
-	Game*    _game;
+	Sound* sound(SoundHandle handle) const;
+	SoundHandle newSound(const lair::Path& name);
+	void eraseSound(SoundHandle handle);
+	Music* newMusic(const lair::Path& name);
+
+	int allocateVoice(const Sound* sound);
+
+	bool isPlaying(int channel) const;
+	int  startChannel(int channel, const Sound* sound, Mix_Chunk* chunk, int loops,
+	                  lair::uint64 time);
+	void haltChannel(int channel);
+	void freeChunk(Mix_Chunk* chunk);
+	void freeMusic(Mix_Music* track);
+
+	void decodeAsync(SoundHandle handle);
+	void soundDecoded(SoundHandle handle, const DataSP& data, const std::string& error);
+	void evictPcm(Sound* sound);
+	void trimPcm(const Sound* keep);
+	void musicLoaded(Music* music, const std::string& error);
+
+private:
+	Game*      _game;
+
+	SoundTable _sounds;
+	std::vector<SoundHandle>
+	           _freeHandles;
+	SoundMap   _soundMap;
+	MusicMap   _musicMap;
+
+	size_t     _pcmBudget;
+	size_t     _pcmBytes;
+	size_t     _compressedBytes;
+
+	Voice      _voices[SOUNDPLAYER_MAX_CHANNELS];
+	std::unique_ptr<Mixer>
+	           _mixer;
+	std::vector<PendingFree>
+	           _pendingFrees;
 
-	SoundMap _soundMap;
-	MusicMap _musicMap;
+	const Music* _pendingMusic;
 };
 
 #endif
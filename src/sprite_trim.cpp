@@ -0,0 +1,73 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "sprite_trim.h"
+
+
+static const Box2 fullView(Vector2(0, 0), Vector2(1, 1));
+
+
+SpriteTrim::SpriteTrim()
+    : _files(),
+      _textures() {
+}
+
+
+void SpriteTrim::load(const Json::Value& json) {
+	_files.clear();
+
+	for(auto it = json.begin(); it != json.end(); ++it) {
+		ViewList& views = _files[it.key().asString()];
+		for(const Json::Value& v: (*it)["views"]) {
+			views.push_back(Box2(Vector2(v[0].asFloat(), v[1].asFloat()),
+			                     Vector2(v[2].asFloat(), v[3].asFloat())));
+		}
+	}
+
+	// Textures bound before the bounds were loaded.
+	for(auto& binding: _textures) {
+		binding.second.views = resolve(binding.second.file);
+	}
+}
+
+
+void SpriteTrim::bind(const Texture* tex, const std::string& file) {
+	_textures[tex] = Binding{ file, resolve(file) };
+}
+
+
+const SpriteTrim::ViewList* SpriteTrim::views(const Texture* tex) const {
+	auto it = _textures.find(tex);
+	return (it != _textures.end())? it->second.views: nullptr;
+}
+
+
+Box2 SpriteTrim::view(const ViewList* views, unsigned index) {
+	if(!views || index >= views->size()) {
+		return fullView;
+	}
+	return (*views)[index];
+}
+
+
+const SpriteTrim::ViewList* SpriteTrim::resolve(const std::string& file) const {
+	auto it = _files.find(file);
+	return (it != _files.end())? &it->second: nullptr;
+}
@@ -0,0 +1,85 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_SPRITE_TRIM_H
+#define _AHIE_SPRITE_TRIM_H
+
+
+#include <vector>
+#include <unordered_map>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+
+
+using namespace lair;
+
+
+namespace lair {
+class Texture;
+}
+
+
+/// Trimmed bounds of the tiles of mostly-transparent sprites.
+///
+/// Bounds are computed offline by bin/sprite_trimmer.py. Each one is a view
+/// box, normalized to the tile, suitable for SpriteComponent::setView: the
+/// sprite keeps its size, anchor and UVs but only the opaque part of the tile
+/// is emitted. Textures can be bound before or after the bounds are loaded.
+///
+/// The views of a texture are resolved when it is bound (or when the bounds
+/// are loaded), so views() costs a single lookup. Callers that update tiles
+/// every frame should keep the returned list instead of looking it up again.
+class SpriteTrim {
+public:
+	typedef std::vector<Box2, Eigen::aligned_allocator<Box2>> ViewList;
+
+public:
+	SpriteTrim();
+
+	void load(const Json::Value& json);
+
+	void bind(const Texture* tex, const std::string& file);
+
+	/// The views of the tiles of `tex`, or nullptr if it is not trimmed. The
+	/// list is valid until the next call to load().
+	const ViewList* views(const Texture* tex) const;
+
+	static Box2 view(const ViewList* views, unsigned index);
+
+protected:
+	struct Binding {
+		std::string     file;
+		const ViewList* views;
+	};
+
+	typedef std::unordered_map<std::string, ViewList> FileMap;
+	typedef std::unordered_map<const Texture*, Binding> TextureMap;
+
+protected:
+	const ViewList* resolve(const std::string& file) const;
+
+protected:
+	FileMap    _files;
+	TextureMap _textures;
+};
+
+
+#endif
@@ -0,0 +1,73 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_SPSC_QUEUE_H
+#define _AHIE_SPSC_QUEUE_H
+
+
+#include <atomic>
+
+
+/// Fixed-size wait-free queue with a single producer thread and a single
+/// consumer thread. Size must be a power of two.
+template<typename T, unsigned Size>
+class SpscQueue {
+public:
+	static_assert(Size && (Size & (Size - 1)) == 0, "Size must be a power of two");
+
+public:
+	SpscQueue()
+	    : _head(0),
+	      _tail(0) {
+	}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	/// Producer side. Fails if the queue is full.
+	bool push(const T& value) {
+		unsigned tail = _tail.load(std::memory_order_relaxed);
+		if(tail - _head.load(std::memory_order_acquire) == Size) {
+			return false;
+		}
+		_items[tail & (Size - 1)] = value;
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// Consumer side. Fails if the queue is empty.
+	bool pop(T* value) {
+		unsigned head = _head.load(std::memory_order_relaxed);
+		if(head == _tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		*value = _items[head & (Size - 1)];
+		_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+protected:
+	std::atomic<unsigned> _head;
+	std::atomic<unsigned> _tail;
+	T                     _items[Size];
+};
+
+
+#endif
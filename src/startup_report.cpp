@@ -0,0 +1,186 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <fstream>
+#include <algorithm>
+
+#include "trace.h"
+
+#include "startup_report.h"
+
+
+static const char* stepNames[StartupReport::N_STEPS] = {
+    "io",
+    "decode",
+    "upload",
+};
+
+
+static double ms(uint64 ns) {
+	return ns / 1000000.;
+}
+
+
+StartupReport::StartupReport()
+    : _start(Tracer::now()),
+      _recording(true),
+      _mutex(),
+      _phases(),
+      _milestones(),
+      _assets(),
+      _threads() {
+	// The report is created by the main thread.
+	_threads[std::this_thread::get_id()] = "main";
+}
+
+
+bool StartupReport::isRecording() const {
+	return _recording.load(std::memory_order_relaxed);
+}
+
+
+void StartupReport::addPhase(const char* name, uint64 start, uint64 end) {
+	if(!isRecording()) {
+		return;
+	}
+	std::unique_lock<std::mutex> lock(_mutex);
+	_phases.push_back(Phase{ name, start - _start, end - _start });
+}
+
+
+void StartupReport::addMilestone(const char* name) {
+	if(!isRecording()) {
+		return;
+	}
+	uint64 time = Tracer::now();
+	std::unique_lock<std::mutex> lock(_mutex);
+	_milestones.push_back(Milestone{ name, time - _start });
+}
+
+
+void StartupReport::addAssetStep(const std::string& asset, const char* kind, Step step,
+                                 uint64 start, uint64 end, uint64 bytes) {
+	if(!isRecording()) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	auto inserted = _assets.insert(std::make_pair(asset, Asset()));
+	Asset& a = inserted.first->second;
+	if(inserted.second) {
+		a.kind  = "";
+		a.start = start - _start;
+		a.end   = end - _start;
+		for(StepInfo& info: a.steps) {
+			info.time  = 0;
+			info.bytes = 0;
+		}
+	}
+	if(kind) {
+		a.kind = kind;
+	}
+	a.start = std::min(a.start, start - _start);
+	a.end   = std::max(a.end,   end - _start);
+
+	StepInfo& info = a.steps[step];
+	info.time  += end - start;
+	info.bytes += bytes;
+	info.thread = threadName();
+}
+
+
+bool StartupReport::write(const std::string& file) {
+	_recording.store(false, std::memory_order_relaxed);
+
+	std::ofstream out(file);
+	if(!out) {
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	out << "{\n";
+
+	out << "  \"phases\": [";
+	for(unsigned i = 0; i < _phases.size(); ++i) {
+		const Phase& phase = _phases[i];
+		out << (i? ",\n    ": "\n    ") << "{\"name\": ";
+		writeJsonString(out, phase.name);
+		out << ", \"start_ms\": " << ms(phase.start)
+		    << ", \"ms\": " << ms(phase.end - phase.start) << "}";
+	}
+	out << "\n  ],\n";
+
+	out << "  \"milestones\": {";
+	for(unsigned i = 0; i < _milestones.size(); ++i) {
+		out << (i? ",\n    ": "\n    ");
+		writeJsonString(out, _milestones[i].name);
+		out << ": " << ms(_milestones[i].time);
+	}
+	out << "\n  },\n";
+
+	// In order of completion, which is the order that matters for startup.
+	std::vector<AssetMap::const_iterator> assets;
+	for(auto it = _assets.begin(); it != _assets.end(); ++it) {
+		assets.push_back(it);
+	}
+	std::sort(assets.begin(), assets.end(),
+	          [](AssetMap::const_iterator a0, AssetMap::const_iterator a1) {
+		return a0->second.end < a1->second.end;
+	});
+
+	out << "  \"assets\": [";
+	for(unsigned i = 0; i < assets.size(); ++i) {
+		const Asset& asset = assets[i]->second;
+		out << (i? ",\n    ": "\n    ") << "{\"name\": ";
+		writeJsonString(out, assets[i]->first.c_str());
+		out << ", \"kind\": ";
+		writeJsonString(out, asset.kind);
+		out << ", \"start_ms\": " << ms(asset.start)
+		    << ", \"end_ms\": " << ms(asset.end);
+		for(int step = 0; step < N_STEPS; ++step) {
+			const StepInfo& info = asset.steps[step];
+			if(info.thread.empty()) {
+				continue;
+			}
+			out << ",\n      ";
+			writeJsonString(out, stepNames[step]);
+			out << ": {\"ms\": " << ms(info.time)
+			    << ", \"bytes\": " << info.bytes << ", \"thread\": ";
+			writeJsonString(out, info.thread.c_str());
+			out << "}";
+		}
+		out << "}";
+	}
+	out << "\n  ]\n";
+
+	out << "}\n";
+	return bool(out);
+}
+
+
+// Called with _mutex held.
+std::string StartupReport::threadName() {
+	auto inserted = _threads.insert(std::make_pair(std::this_thread::get_id(), std::string()));
+	if(inserted.second) {
+		// As named in the trace.
+		inserted.first->second = "loader";
+	}
+	return inserted.first->second;
+}
@@ -0,0 +1,118 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_STARTUP_REPORT_H
+#define _AHIE_STARTUP_REPORT_H
+
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+#include <lair/core/lair.h>
+
+
+#define STARTUP_REPORT_FILE "startup.json"
+
+
+using namespace lair;
+
+
+/// Timeline of the startup: initialization phases, milestones (title shown,
+/// game ready) and, per asset, the time spent in I/O, decoding and GPU upload,
+/// with the bytes processed and the thread that did the work.
+///
+/// Thread-safe. Times use the Tracer::now() clock and are relative to the
+/// construction of the report. Once written, the report stops recording, so
+/// that later loads (evicted assets, game over screens) do not blur the
+/// startup figures.
+class StartupReport {
+public:
+	enum Step {
+		IO,
+		DECODE,
+		UPLOAD,
+		N_STEPS
+	};
+
+public:
+	StartupReport();
+	StartupReport(const StartupReport&) = delete;
+
+	StartupReport& operator=(const StartupReport&) = delete;
+
+	bool isRecording() const;
+
+	void addPhase(const char* name, uint64 start, uint64 end);
+	void addMilestone(const char* name);
+	/// kind may be null to keep the kind of a previous step.
+	void addAssetStep(const std::string& asset, const char* kind, Step step,
+	                  uint64 start, uint64 end, uint64 bytes = 0);
+
+	/// Writes the report and stops recording.
+	bool write(const std::string& file);
+
+protected:
+	struct Phase {
+		const char* name;
+		uint64      start;
+		uint64      end;
+	};
+
+	struct Milestone {
+		const char* name;
+		uint64      time;
+	};
+
+	struct StepInfo {
+		uint64      time;
+		uint64      bytes;
+		std::string thread;
+	};
+
+	struct Asset {
+		const char* kind;
+		uint64      start;
+		uint64      end;
+		StepInfo    steps[N_STEPS];
+	};
+
+	typedef std::map<std::string, Asset> AssetMap;
+	typedef std::map<std::thread::id, std::string> ThreadMap;
+
+protected:
+	std::string threadName();
+
+protected:
+	uint64                 _start;
+	std::atomic<bool>      _recording;
+
+	std::mutex             _mutex;
+	std::vector<Phase>     _phases;
+	std::vector<Milestone> _milestones;
+	AssetMap               _assets;
+	ThreadMap              _threads;
+};
+
+
+#endif
@@ -0,0 +1,213 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "trace.h"
+
+#include "task_pool.h"
+
+
+// Links the trace of the task to the scope that queued it.
+static TaskPool::Task tracedTask(const TaskPool::Task& task, const char* name) {
+	if(!Tracer::instance().isEnabled()) {
+		return task;
+	}
+	uint64 id = Tracer::instance().newFlowId();
+	TRACE_FLOW_BEGIN(name, id);
+	return [task, name, id] {
+		TRACE_SCOPE(name);
+		TRACE_FLOW_END(name, id);
+		task();
+	};
+}
+
+
+TaskPool::TaskPool()
+    : _mutex(),
+      _cond(),
+      _threads(),
+      _stopping(false),
+      _nRunning(0),
+      _tasks(),
+      _mainTasks() {
+}
+
+
+TaskPool::~TaskPool() {
+	stop();
+}
+
+
+unsigned TaskPool::nThreads() const {
+	std::unique_lock<std::mutex> lock(_mutex);
+	return _threads.size();
+}
+
+
+void TaskPool::start(unsigned nThreads) {
+	stop();
+	std::unique_lock<std::mutex> lock(_mutex);
+	_stopping = false;
+	for(unsigned i = 0; i < nThreads; ++i) {
+		_threads.emplace_back(&TaskPool::workerMain, this);
+	}
+}
+
+
+// _threads and _stopping are read by enqueue() from any thread: they only
+// change under the lock, and the workers are joined outside of it.
+void TaskPool::stop() {
+	std::vector<std::thread> threads;
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_stopping = true;
+		threads.swap(_threads);
+	}
+	_cond.notify_all();
+	for(std::thread& thread: threads) {
+		thread.join();
+	}
+
+	// They may reference objects that are about to be destroyed.
+	std::unique_lock<std::mutex> lock(_mutex);
+	_tasks.clear();
+	_mainTasks.clear();
+}
+
+
+void TaskPool::enqueue(const Task& task) {
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		if(_stopping) {
+			return;
+		}
+		if(!_threads.empty()) {
+			_tasks.push_back(tracedTask(task, "task"));
+			lock.unlock();
+			_cond.notify_one();
+			return;
+		}
+	}
+
+	// No worker: behave synchronously.
+	task();
+}
+
+
+void TaskPool::post(const Task& task) {
+	std::unique_lock<std::mutex> lock(_mutex);
+	if(_stopping) {
+		return;
+	}
+	_mainTasks.push_back(tracedTask(task, "main thread task"));
+}
+
+
+unsigned TaskPool::runMainThreadTasks(unsigned maxTasks) {
+	unsigned count = 0;
+	while(count < maxTasks) {
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if(_mainTasks.empty()) {
+				break;
+			}
+			task = std::move(_mainTasks.front());
+			_mainTasks.pop_front();
+		}
+		task();
+		++count;
+	}
+	return count;
+}
+
+
+bool TaskPool::isIdle() const {
+	std::unique_lock<std::mutex> lock(_mutex);
+	return _tasks.empty() && _mainTasks.empty() && _nRunning == 0;
+}
+
+
+void TaskPool::workerMain() {
+	TRACE_THREAD_NAME("loader");
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while(true) {
+		_cond.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+		if(_stopping) {
+			return;
+		}
+
+		Task task = std::move(_tasks.front());
+		_tasks.pop_front();
+		++_nRunning;
+
+		lock.unlock();
+		task();
+		lock.lock();
+
+		--_nRunning;
+	}
+}
+
+
+//---------------------------------------------------------------------------//
+
+
+LoadProgress::LoadProgress()
+    : _total(0),
+      _completed(0) {
+}
+
+
+void LoadProgress::reset() {
+	_total     = 0;
+	_completed = 0;
+}
+
+
+void LoadProgress::add(unsigned count) {
+	_total += count;
+}
+
+
+void LoadProgress::done(unsigned count) {
+	_completed += count;
+}
+
+
+unsigned LoadProgress::total() const {
+	return _total;
+}
+
+
+unsigned LoadProgress::completed() const {
+	return _completed;
+}
+
+
+float LoadProgress::progress() const {
+	unsigned total = _total;
+	return total? float(_completed) / total: 1.f;
+}
+
+
+bool LoadProgress::isDone() const {
+	return _completed >= _total;
+}
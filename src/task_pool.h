@@ -0,0 +1,108 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_TASK_POOL_H
+#define _AHIE_TASK_POOL_H
+
+
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include <lair/core/lair.h>
+
+
+using namespace lair;
+
+
+/// Worker threads for blocking work (file I/O, decoding), plus a queue of
+/// tasks that must run on the main thread (everything touching OpenGL or the
+/// game state).
+///
+/// Workers hand their results back with post(); the main thread executes them
+/// from runMainThreadTasks(), typically once per frame.
+class TaskPool {
+public:
+	typedef std::function<void()> Task;
+
+public:
+	TaskPool();
+	TaskPool(const TaskPool&) = delete;
+	~TaskPool();
+
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	unsigned nThreads() const;
+	void start(unsigned nThreads);
+	/// Joins the workers once their current task is done. Queued and posted
+	/// tasks are discarded, and later ones are ignored until start().
+	void stop();
+
+	void enqueue(const Task& task);
+	void post(const Task& task);
+
+	unsigned runMainThreadTasks(unsigned maxTasks = unsigned(-1));
+
+	bool isIdle() const;
+
+protected:
+	void workerMain();
+
+protected:
+	typedef std::deque<Task> TaskQueue;
+
+protected:
+	mutable std::mutex       _mutex;
+	std::condition_variable  _cond;
+	std::vector<std::thread> _threads;
+	bool                     _stopping;
+	unsigned                 _nRunning;
+
+	TaskQueue                _tasks;
+	TaskQueue                _mainTasks;
+};
+
+
+/// Counts the completion of a group of asynchronous loads. Can be updated
+/// from any thread.
+class LoadProgress {
+public:
+	LoadProgress();
+
+	void reset();
+	void add(unsigned count = 1);
+	void done(unsigned count = 1);
+
+	unsigned total() const;
+	unsigned completed() const;
+	float progress() const;
+	bool isDone() const;
+
+protected:
+	std::atomic<unsigned> _total;
+	std::atomic<unsigned> _completed;
+};
+
+
+#endif
@@ -0,0 +1,259 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <sys/stat.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#include "texture_cache.h"
+
+
+// Bump the version when the decoding changes (downsampling filter, ...).
+static const char   cacheMagic[8]   = { 'A', 'H', 'I', 'E', 'T', 'X', '0', '1' };
+static const size_t cacheHeaderSize = 32;
+
+struct CacheHeader {
+	char   magic[8];
+	uint64 key;
+	uint32 width;
+	uint32 height;
+	uint32 reserved[2];
+};
+
+static_assert(sizeof(CacheHeader) == cacheHeaderSize, "CacheHeader must match the file layout");
+
+
+static void fnv1a(uint64* hash, const void* data, size_t size) {
+	const uint8* bytes = static_cast<const uint8*>(data);
+	uint64 h = *hash;
+	for(size_t i = 0; i < size; ++i) {
+		h ^= bytes[i];
+		h *= 0x100000001b3ull;
+	}
+	*hash = h;
+}
+
+
+TextureCache::TextureCache()
+    : _dir(),
+      _enabled(false),
+      _maxSize(TEXTURE_CACHE_DEFAULT_SIZE) {
+}
+
+
+bool TextureCache::setDirectory(const Path& dir) {
+	_dir = dir;
+#ifdef _WIN32
+	int result = _mkdir(dir.utf8CStr());
+#else
+	int result = mkdir(dir.utf8CStr(), 0755);
+#endif
+	_enabled = (result == 0 || errno == EEXIST);
+	return _enabled;
+}
+
+
+bool TextureCache::isEnabled() const {
+	return _enabled;
+}
+
+
+size_t TextureCache::maxSize() const {
+	return _maxSize;
+}
+
+
+void TextureCache::setMaxSize(size_t bytes) {
+	_maxSize = bytes;
+}
+
+
+uint64 TextureCache::key(const void* data, size_t size, unsigned flags,
+                         unsigned downsample) {
+	uint64 hash = 0xcbf29ce484222325ull;
+	fnv1a(&hash, data, size);
+	fnv1a(&hash, &flags, sizeof(flags));
+	fnv1a(&hash, &downsample, sizeof(downsample));
+	return hash;
+}
+
+
+bool TextureCache::load(uint64 key, Image* image) const {
+	if(!_enabled || !image->file.open(entryPath(key))) {
+		return false;
+	}
+
+	CacheHeader header;
+	if(image->file.size() < cacheHeaderSize) {
+		image->file.close();
+		return false;
+	}
+	std::memcpy(&header, image->file.data(), cacheHeaderSize);
+
+	size_t bytes = size_t(header.width) * header.height * 4;
+	if(std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0
+	|| header.key != key || image->file.size() != cacheHeaderSize + bytes) {
+		// Stale or truncated, it will be overwritten.
+		image->file.close();
+		return false;
+	}
+
+	image->width  = header.width;
+	image->height = header.height;
+	image->pixels = image->file.data() + cacheHeaderSize;
+
+	// Mark the entry as recently used for prune().
+#ifdef _WIN32
+	_utime(entryPath(key).utf8CStr(), nullptr);
+#else
+	utime(entryPath(key).utf8CStr(), nullptr);
+#endif
+	return true;
+}
+
+
+bool TextureCache::store(uint64 key, unsigned width, unsigned height,
+                         const uint8* pixels) const {
+	if(!_enabled) {
+		return false;
+	}
+
+	CacheHeader header;
+	std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.key         = key;
+	header.width       = width;
+	header.height      = height;
+	header.reserved[0] = 0;
+	header.reserved[1] = 0;
+
+	// Write then rename, so a concurrent or interrupted write never leaves a
+	// partial entry behind.
+	Path path = entryPath(key);
+	std::string tmp = path.native() + ".tmp"
+	                + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(pixels), size_t(width) * height * 4);
+		if(!out) {
+			out.close();
+			std::remove(tmp.c_str());
+			return false;
+		}
+	}
+
+	// rename() does not replace an existing file on Windows.
+#ifdef _WIN32
+	bool moved = MoveFileExA(tmp.c_str(), path.utf8CStr(), MOVEFILE_REPLACE_EXISTING);
+#else
+	bool moved = std::rename(tmp.c_str(), path.utf8CStr()) == 0;
+#endif
+	if(!moved) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+
+unsigned TextureCache::prune() const {
+	if(!_enabled) {
+		return 0;
+	}
+
+	struct CacheFile {
+		std::string name;
+		uint64      size;
+		uint64      lastUse;
+	};
+	std::vector<CacheFile> files;
+	uint64 total = 0;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((_dir / "*.rgba").utf8CStr(), &data);
+	if(find != INVALID_HANDLE_VALUE) {
+		do {
+			uint64 size    = (uint64(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+			uint64 lastUse = (uint64(data.ftLastWriteTime.dwHighDateTime) << 32)
+			               | data.ftLastWriteTime.dwLowDateTime;
+			files.push_back(CacheFile{ data.cFileName, size, lastUse });
+			total += size;
+		} while(FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	DIR* dir = opendir(_dir.utf8CStr());
+	if(dir) {
+		while(dirent* entry = readdir(dir)) {
+			std::string name = entry->d_name;
+			struct stat st;
+			if(name.size() < 5 || name.compare(name.size() - 5, 5, ".rgba") != 0
+			|| stat((_dir / name).utf8CStr(), &st) != 0) {
+				continue;
+			}
+			files.push_back(CacheFile{ name, uint64(st.st_size), uint64(st.st_mtime) });
+			total += st.st_size;
+		}
+		closedir(dir);
+	}
+#endif
+
+	std::sort(files.begin(), files.end(),
+	          [](const CacheFile& a, const CacheFile& b) {
+		return a.lastUse < b.lastUse;
+	});
+
+	unsigned removed = 0;
+	for(const CacheFile& file: files) {
+		if(total <= _maxSize) {
+			break;
+		}
+		// Entries that are mapped can not be removed on Windows, they are
+		// simply kept.
+		if(std::remove((_dir / file.name).utf8CStr()) == 0) {
+			total -= file.size;
+			++removed;
+		}
+	}
+	return removed;
+}
+
+
+Path TextureCache::entryPath(uint64 key) const {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.rgba", (unsigned long long)key);
+	return _dir / name;
+}
@@ -0,0 +1,93 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_TEXTURE_CACHE_H
+#define _AHIE_TEXTURE_CACHE_H
+
+
+#include <string>
+
+#include <lair/core/lair.h>
+#include <lair/core/path.h>
+
+#include "asset_pack.h"
+
+
+#define TEXTURE_CACHE_DIR          "texture_cache"
+#define TEXTURE_CACHE_DEFAULT_SIZE (256 << 20)
+
+
+using namespace lair;
+
+
+/// Disk cache of decoded RGBA8 images, so that warm starts skip PNG
+/// decoding.
+///
+/// Entries are keyed by a hash of the source file content and of the
+/// decoding parameters, so a modified asset simply misses the cache. Cached
+/// images are memory-mapped; lair uploads textures from an Image, so the
+/// decoding worker copies them out of the mapping. Thread-safe.
+///
+/// Loading an entry touches its modification time, so that prune() can drop
+/// the least recently used entries when the cache exceeds maxSize().
+class TextureCache {
+public:
+	struct Image {
+		unsigned     width;
+		unsigned     height;
+		const uint8* pixels;
+		MappedFile   file;
+	};
+
+public:
+	TextureCache();
+	TextureCache(const TextureCache&) = delete;
+
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	/// Creates dir if needed. The cache is disabled if it fails.
+	bool setDirectory(const Path& dir);
+	bool isEnabled() const;
+
+	size_t maxSize() const;
+	void setMaxSize(size_t bytes);
+
+	static uint64 key(const void* data, size_t size, unsigned flags,
+	                  unsigned downsample);
+
+	bool load(uint64 key, Image* image) const;
+	bool store(uint64 key, unsigned width, unsigned height,
+	           const uint8* pixels) const;
+
+	/// Removes the least recently used entries until the cache fits in
+	/// maxSize(). Returns the number of removed entries.
+	unsigned prune() const;
+
+protected:
+	Path entryPath(uint64 key) const;
+
+protected:
+	Path   _dir;
+	bool   _enabled;
+	size_t _maxSize;
+};
+
+
+#endif
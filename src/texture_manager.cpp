@@ -0,0 +1,564 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstring>
+#include <algorithm>
+
+#include <SDL_image.h>
+
+#include <lair/core/image.h>
+
+#include <lair/render_gl2/renderer.h>
+
+#include "game.h"
+#include "trace.h"
+
+#include "texture_manager.h"
+
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+#define RGBA_PIXEL_FORMAT SDL_PIXELFORMAT_RGBA8888
+#else
+#define RGBA_PIXEL_FORMAT SDL_PIXELFORMAT_ABGR8888
+#endif
+
+
+TextureManager::TextureManager(Game* game)
+    : _game(game),
+      _budget(TEXTURE_DEFAULT_BUDGET),
+      _viewScale(1),
+      _cache(),
+      _entries(),
+      _textures(),
+      _residentBytes(0),
+      _uploadedBytes(0),
+      _nLoading(0),
+      _decodedMutex(),
+      _decodedCond(),
+      _decoded() {
+}
+
+
+TextureManager::~TextureManager() {
+}
+
+
+size_t TextureManager::budget() const {
+	return _budget;
+}
+
+
+void TextureManager::setBudget(size_t bytes) {
+	_budget = bytes;
+}
+
+
+float TextureManager::viewScale() const {
+	return _viewScale;
+}
+
+
+void TextureManager::setViewScale(float scale) {
+	_viewScale = scale;
+}
+
+
+Texture* TextureManager::get(const std::string& file, unsigned flags,
+                             float displayScale) {
+	return entry(file, flags, displayScale).texture.get();
+}
+
+
+void TextureManager::prefetch(const std::string& file, unsigned flags,
+                              float displayScale) {
+	Entry& e = entry(file, flags, displayScale);
+	reselect(e);
+	if(e.info.state != UNLOADED) {
+		return;
+	}
+
+	e.requested  = idealDownscale(e);
+	e.info.state = LOADING;
+	++e.generation;
+	++_nLoading;
+
+	std::string key        = entryKey(file, flags);
+	unsigned    downscale  = e.requested;
+	size_t      available  = availableBytes();
+	unsigned    generation = e.generation;
+	_game->tasks()->enqueue([this, key, file, flags, downscale, available, generation] {
+		ImageSP image = decode(file, flags, downscale, available);
+
+		{
+			std::unique_lock<std::mutex> lock(_decodedMutex);
+			_decoded.push_back(Decoded{ key, generation, image });
+		}
+		_decodedCond.notify_all();
+	});
+}
+
+
+Texture* TextureManager::load(const std::string& file, unsigned flags,
+                              float displayScale) {
+	Entry& e = entry(file, flags, displayScale);
+	reselect(e);
+	if(e.info.state == RESIDENT) {
+		return e.texture.get();
+	}
+
+	// Already being decoded: wait for the worker instead of decoding twice.
+	// Only this texture is uploaded, the others are left to the per-frame
+	// update() so that the frame does not stall on them.
+	if(e.info.state == LOADING) {
+		Decoded decoded;
+		{
+			std::string key = entryKey(file, flags);
+			std::unique_lock<std::mutex> lock(_decodedMutex);
+			DecodedQueue::iterator found;
+			_decodedCond.wait(lock, [this, &e, &key, &found] {
+				found = std::find_if(_decoded.begin(), _decoded.end(),
+				                     [&e, &key](const Decoded& d) {
+					return d.key == key && d.generation == e.generation;
+				});
+				return found != _decoded.end();
+			});
+			decoded = std::move(*found);
+			_decoded.erase(found);
+		}
+
+		--_nLoading;
+		if(decoded.image) {
+			upload(e, *decoded.image);
+		} else {
+			_game->log().error("Failed to load texture \"", e.info.variant, "\"");
+			e.info.state = UNLOADED;
+		}
+	}
+	if(e.info.state == RESIDENT) {
+		return e.texture.get();
+	}
+
+	e.requested = idealDownscale(e);
+	++e.generation;
+
+	_game->log().log("Blocking load of \"", e.info.file, "\"");
+	ImageSP image = decode(e.info.file, e.flags, e.requested, availableBytes());
+	if(image) {
+		upload(e, *image);
+	} else {
+		_game->log().error("Failed to load texture \"", e.info.variant, "\"");
+		e.info.state = UNLOADED;
+	}
+
+	return e.texture.get();
+}
+
+
+void TextureManager::evict(const std::string& file, unsigned flags) {
+	auto it = _entries.find(entryKey(file, flags));
+	if(it != _entries.end()) {
+		evict(it->second);
+	}
+}
+
+
+void TextureManager::evict(Entry& e) {
+	if(e.info.state == RESIDENT) {
+		_game->log().log("Evict texture \"", e.info.variant, "\"...");
+		// Handles must stay valid, and Texture can only free its storage
+		// through a new upload: keep a single transparent texel.
+		lair::Image empty(1, 1, lair::Image::FormatRGBA8);
+		std::memset(empty.data(), 0, 4);
+		e.texture->upload(empty);
+		_residentBytes -= e.info.bytes;
+	} else if(e.info.state == LOADING) {
+		--_nLoading;
+	}
+	e.info.state = UNLOADED;
+	++e.generation;
+}
+
+
+TextureManager::State TextureManager::state(const Texture* tex) const {
+	auto it = _textures.find(tex);
+	return (it != _textures.end())? it->second->info.state: UNLOADED;
+}
+
+
+bool TextureManager::isResident(const std::string& file, unsigned flags) const {
+	auto it = _entries.find(entryKey(file, flags));
+	return it != _entries.end() && it->second.info.state == RESIDENT;
+}
+
+
+bool TextureManager::isResident(const Texture* tex) const {
+	auto it = _textures.find(tex);
+	return it != _textures.end() && it->second->info.state == RESIDENT;
+}
+
+
+bool TextureManager::isLoading() const {
+	return _nLoading;
+}
+
+
+unsigned TextureManager::update(unsigned maxUploads) {
+	unsigned count = 0;
+	while(count < maxUploads) {
+		Decoded decoded;
+		{
+			std::unique_lock<std::mutex> lock(_decodedMutex);
+			if(_decoded.empty()) {
+				break;
+			}
+			decoded = std::move(_decoded.front());
+			_decoded.pop_front();
+		}
+
+		auto it = _entries.find(decoded.key);
+		if(it == _entries.end()
+		|| it->second.generation != decoded.generation
+		|| it->second.info.state != LOADING) {
+			// Evicted or loaded synchronously in the meantime.
+			continue;
+		}
+
+		Entry& e = it->second;
+		--_nLoading;
+		if(decoded.image) {
+			upload(e, *decoded.image);
+			++count;
+		} else {
+			_game->log().error("Failed to load texture \"", e.info.variant, "\"");
+			e.info.state = UNLOADED;
+		}
+	}
+	return count;
+}
+
+
+float TextureManager::scale(const Texture* tex) const {
+	auto it = _textures.find(tex);
+	return (it != _textures.end())? 1.f / it->second->info.downscale: 1.f;
+}
+
+
+TextureCache* TextureManager::cache() {
+	return &_cache;
+}
+
+
+void TextureManager::residentTextures(std::vector<Texture*>* textures) const {
+	for(const auto& entry: _entries) {
+		if(entry.second.info.state == RESIDENT) {
+			textures->push_back(entry.second.texture.get());
+		}
+	}
+}
+
+
+size_t TextureManager::residentBytes() const {
+	return _residentBytes;
+}
+
+
+uint64 TextureManager::uploadedBytes() const {
+	return _uploadedBytes;
+}
+
+
+TextureManager::InfoList TextureManager::residency() const {
+	InfoList list;
+	for(const auto& entry: _entries) {
+		list.push_back(entry.second.info);
+	}
+	std::sort(list.begin(), list.end(),
+	          [](const TextureInfo& a, const TextureInfo& b) {
+		return a.bytes > b.bytes;
+	});
+	return list;
+}
+
+
+void TextureManager::logResidency() {
+	static const char* stateNames[] = { "unloaded", "loading", "resident" };
+
+	_game->log().info("Texture residency (view scale ", _viewScale, "):");
+	for(const TextureInfo& info: residency()) {
+		_game->log().info("  ", info.variant, ": ", stateNames[info.state], ", ",
+		                  info.width, "x", info.height, " (1/", info.downscale, "), ",
+		                  info.bytes >> 10, " KiB");
+	}
+	_game->log().info("  total: ", _residentBytes >> 10, " / ", _budget >> 10, " KiB");
+}
+
+
+std::string TextureManager::entryKey(const std::string& file, unsigned flags) {
+	return file + "#" + std::to_string(flags);
+}
+
+
+TextureManager::Entry& TextureManager::entry(const std::string& file, unsigned flags,
+                                             float displayScale) {
+	std::string key = entryKey(file, flags);
+	auto it = _entries.find(key);
+	if(it != _entries.end()) {
+		Entry& e = it->second;
+		e.displayScale = std::max(e.displayScale, displayScale);
+		return e;
+	}
+
+	Entry& e = _entries[key];
+	e.texture.reset(new Texture(_game->renderer()));
+	e.flags        = flags;
+	e.displayScale = displayScale;
+	e.requested    = 1;
+	e.generation   = 0;
+
+	e.info.file      = file;
+	e.info.variant   = file;
+	e.info.texture   = e.texture.get();
+	e.info.state     = UNLOADED;
+	e.info.downscale = 1;
+	e.info.width     = 0;
+	e.info.height    = 0;
+	e.info.bytes     = 0;
+
+	_textures.emplace(e.texture.get(), &e);
+	return e;
+}
+
+
+// The texture may have been loaded for a smaller display than requested now.
+void TextureManager::reselect(Entry& e) {
+	if(e.info.state != UNLOADED && idealDownscale(e) < e.requested) {
+		_game->log().log("Reload texture \"", e.info.file, "\" for a larger display");
+		evict(e);
+	}
+}
+
+
+// The finest downscale that is not wasted on the screen. The budget may
+// require a coarser one, see decode().
+unsigned TextureManager::idealDownscale(const Entry& e) const {
+	bool pixelArt = (e.flags & Texture::BILINEAR) != Texture::BILINEAR;
+	if(pixelArt) {
+		return 1;
+	}
+
+	float ideal = 1.f / std::max(_viewScale * e.displayScale, 1.e-6f);
+	unsigned ds = 1;
+	while(ds < TEXTURE_MAX_DOWNSCALE && ds * 2 <= ideal) {
+		ds *= 2;
+	}
+	return ds;
+}
+
+
+size_t TextureManager::availableBytes() const {
+	return (_residentBytes < _budget)? _budget - _residentBytes: 0;
+}
+
+
+void TextureManager::upload(Entry& e, const DecodedImage& image) {
+	uint64 start = Tracer::now();
+	e.info.variant   = image.variant;
+	e.info.downscale = image.downscale;
+
+	size_t bytes = size_t(image.width) * image.height * 4;
+	if(_residentBytes + bytes > _budget) {
+		_game->log().warning("Texture budget exceeded by \"", e.info.variant, "\": ",
+		                     (_residentBytes + bytes) >> 10, " / ",
+		                     _budget >> 10, " KiB");
+	}
+
+	e.texture->upload(*image.pixels);
+	e.texture->setFlags(e.flags);
+
+	e.info.state  = RESIDENT;
+	e.info.width  = e.texture->width();
+	e.info.height = e.texture->height();
+	e.info.bytes  = size_t(e.info.width) * e.info.height * 4;
+	_residentBytes += e.info.bytes;
+	_uploadedBytes += uint64(image.width) * image.height * 4;
+
+	_game->startup()->addAssetStep(e.info.variant, nullptr, StartupReport::UPLOAD,
+	                               start, Tracer::now(), e.info.bytes);
+}
+
+
+// Box filter, colors weighted by alpha so transparent pixels do not bleed.
+static void halveImage(unsigned* width, unsigned* height, std::vector<uint8>* pixels) {
+	unsigned w  = *width;
+	unsigned h  = *height;
+	unsigned hw = std::max(w / 2, 1u);
+	unsigned hh = std::max(h / 2, 1u);
+
+	std::vector<uint8> out(hw * hh * 4);
+	for(unsigned y = 0; y < hh; ++y) {
+		const uint8* r0 = &(*pixels)[std::min(2*y,     h-1) * w * 4];
+		const uint8* r1 = &(*pixels)[std::min(2*y + 1, h-1) * w * 4];
+		for(unsigned x = 0; x < hw; ++x) {
+			unsigned i0 = std::min(2*x,     w-1) * 4;
+			unsigned i1 = std::min(2*x + 1, w-1) * 4;
+			const uint8* p[4] = { r0 + i0, r0 + i1, r1 + i0, r1 + i1 };
+			unsigned a = p[0][3] + p[1][3] + p[2][3] + p[3][3];
+			uint8* o = &out[(y * hw + x) * 4];
+			for(unsigned c = 0; c < 3; ++c) {
+				unsigned sum = p[0][c]*p[0][3] + p[1][c]*p[1][3]
+				             + p[2][c]*p[2][3] + p[3][c]*p[3][3];
+				o[c] = a? (sum + a/2) / a: 0;
+			}
+			o[3] = (a + 2) / 4;
+		}
+	}
+
+	*width  = hw;
+	*height = hh;
+	pixels->swap(out);
+}
+
+
+// Picks the variant, coarser than downscale if the image does not fit in
+// available bytes, then decodes it. The closest pre-scaled variant is used,
+// and downsampled for what remains.
+TextureManager::ImageSP TextureManager::decode(const std::string& file, unsigned flags,
+                                               unsigned downscale, size_t available) const {
+	// Runs on worker threads: only the asset file system, the cache and the
+	// startup report may be used, do not touch the rest of the game or the
+	// logger.
+	TRACE_SCOPE_DETAIL("decodeTexture", file.c_str());
+	StartupReport* startup = _game->startup();
+	uint64 start = Tracer::now();
+
+	bool pixelArt = (flags & Texture::BILINEAR) != Texture::BILINEAR;
+	unsigned width, height;
+	if(!pixelArt && imageSize(file, &width, &height)) {
+		size_t bytes = size_t(width) * height * 4;
+		while(downscale < TEXTURE_MAX_DOWNSCALE && bytes / (downscale * downscale) > available) {
+			downscale *= 2;
+		}
+	}
+
+	std::string variant;
+	AssetData   source;
+	unsigned    downsample = 1;
+	for(; downsample <= downscale; downsample *= 2) {
+		variant = (downsample < downscale)? variantFile(file, downscale / downsample): file;
+		if(_game->assets()->read(variant, &source)) {
+			break;
+		}
+	}
+	if(downsample > downscale) {
+		return ImageSP();
+	}
+
+	ImageSP image = std::make_shared<DecodedImage>();
+	image->variant   = variant;
+	image->downscale = downscale;
+	uint64 key = TextureCache::key(source.data, source.size, flags, downsample);
+	TextureCache::Image cached;
+	if(_cache.load(key, &cached)) {
+		// lair only uploads from an Image: the copy out of the mapping is done
+		// here rather than on the main thread.
+		image->width  = cached.width;
+		image->height = cached.height;
+		image->pixels.reset(new lair::Image(cached.width, cached.height,
+		                                    lair::Image::FormatRGBA8));
+		std::memcpy(image->pixels->data(), cached.pixels,
+		            size_t(cached.width) * cached.height * 4);
+		startup->addAssetStep(variant, "texture", StartupReport::IO, start, Tracer::now(),
+		                      source.size + cached.file.size());
+		return image;
+	}
+	uint64 decodeStart = Tracer::now();
+	startup->addAssetStep(variant, "texture", StartupReport::IO, start, decodeStart, source.size);
+
+	SDL_Surface* surface = IMG_Load_RW(SDL_RWFromConstMem(source.data, source.size), 1);
+	if(!surface) {
+		return ImageSP();
+	}
+	SDL_Surface* rgba = SDL_ConvertSurfaceFormat(surface, RGBA_PIXEL_FORMAT, 0);
+	SDL_FreeSurface(surface);
+	if(!rgba) {
+		return ImageSP();
+	}
+
+	image->width  = rgba->w;
+	image->height = rgba->h;
+	std::vector<uint8> pixels(image->width * image->height * 4);
+
+	SDL_LockSurface(rgba);
+	for(unsigned y = 0; y < image->height; ++y) {
+		std::memcpy(&pixels[y * image->width * 4],
+		            static_cast<const uint8*>(rgba->pixels) + y * rgba->pitch,
+		            image->width * 4);
+	}
+	SDL_UnlockSurface(rgba);
+	SDL_FreeSurface(rgba);
+
+	for(; downsample > 1; downsample /= 2) {
+		halveImage(&image->width, &image->height, &pixels);
+	}
+	image->pixels.reset(new lair::Image(image->width, image->height,
+	                                    lair::Image::FormatRGBA8));
+	std::memcpy(image->pixels->data(), pixels.data(), pixels.size());
+
+	uint64 storeStart = Tracer::now();
+	startup->addAssetStep(variant, nullptr, StartupReport::DECODE, decodeStart, storeStart,
+	                      pixels.size());
+
+	_cache.store(key, image->width, image->height, pixels.data());
+	startup->addAssetStep(variant, nullptr, StartupReport::IO, storeStart, Tracer::now(),
+	                      pixels.size());
+
+	return image;
+}
+
+
+std::string TextureManager::variantFile(const std::string& file, unsigned downscale) const {
+	size_t dot = file.rfind('.');
+	std::string suffix = "@" + std::to_string(downscale);
+	if(dot == std::string::npos) {
+		return file + suffix;
+	}
+	return file.substr(0, dot) + suffix + file.substr(dot);
+}
+
+
+bool TextureManager::imageSize(const std::string& file,
+                               unsigned* width, unsigned* height) const {
+	// Only reads the PNG signature and the IHDR chunk.
+	unsigned char header[24];
+	SDL_RWops* rw = _game->assets()->open(file);
+	bool ok = rw && SDL_RWread(rw, header, sizeof(header), 1) == 1;
+	if(rw) {
+		SDL_RWclose(rw);
+	}
+	if(!ok || header[1] != 'P' || header[2] != 'N' || header[3] != 'G') {
+		*width  = 0;
+		*height = 0;
+		return false;
+	}
+
+	*width  = (header[16] << 24) | (header[17] << 16) | (header[18] << 8) | header[19];
+	*height = (header[20] << 24) | (header[21] << 16) | (header[22] << 8) | header[23];
+	return true;
+}
@@ -0,0 +1,209 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_TEXTURE_MANAGER_H
+#define _AHIE_TEXTURE_MANAGER_H
+
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include <lair/core/lair.h>
+#include <lair/core/log.h>
+#include <lair/core/path.h>
+#include <lair/core/image.h>
+
+#include <lair/render_gl2/texture.h>
+
+#include "texture_cache.h"
+
+
+#define TEXTURE_REFERENCE_HEIGHT  1080
+#define TEXTURE_DEFAULT_BUDGET    (128 << 20)
+#define TEXTURE_MAX_DOWNSCALE     4
+#define TEXTURE_UPLOADS_PER_FRAME 1
+
+
+using namespace lair;
+
+
+class Game;
+
+
+/// Loads textures, picking a pre-scaled variant when the full resolution
+/// would be wasted.
+///
+/// Assets are authored for a 1080 pixels high screen. Variants "name@2.png"
+/// and "name@4.png" are generated by bin/texture_variants.py. The variant is
+/// chosen from the view scale (window size relative to the reference height)
+/// and from a per-texture display scale, then made coarser if needed to stay
+/// within the memory budget. When a variant is missing, the finest available
+/// image is downsampled after decoding.
+///
+/// Textures using Texture::NEAREST are pixel art and always loaded at full
+/// resolution.
+///
+/// A texture is identified by its file and flags. When it is requested again
+/// for a larger display scale, the largest one is kept, and the texture is
+/// loaded again if that needs a finer variant. Variants are probed on the
+/// worker thread that decodes the image, so the main thread does no file
+/// I/O; the variant and size of a texture are known once it is uploaded.
+///
+/// Decoded images are kept in a TextureCache, when it is enabled.
+///
+/// Residency is explicit: get() only returns a handle, prefetch() decodes the
+/// image on a worker thread and load() blocks until the texture is usable.
+/// Decoded images are uploaded by update(), on the main thread. Handles stay
+/// valid after evict(), the texture is simply empty until it is loaded again.
+class TextureManager {
+public:
+	enum State {
+		UNLOADED,
+		LOADING,
+		RESIDENT
+	};
+
+	struct TextureInfo {
+		std::string file;
+		std::string variant;
+		Texture*    texture;
+		State       state;
+		unsigned    downscale;
+		unsigned    width;
+		unsigned    height;
+		size_t      bytes;
+	};
+	typedef std::vector<TextureInfo> InfoList;
+
+public:
+	TextureManager(Game* game);
+	TextureManager(const TextureManager&) = delete;
+	~TextureManager();
+
+	TextureManager& operator=(const TextureManager&) = delete;
+
+	size_t budget() const;
+	void setBudget(size_t bytes);
+
+	float viewScale() const;
+	void setViewScale(float scale);
+
+	Texture* get(const std::string& file, unsigned flags,
+	             float displayScale = 1);
+	void prefetch(const std::string& file, unsigned flags,
+	              float displayScale = 1);
+	Texture* load(const std::string& file, unsigned flags,
+	              float displayScale = 1);
+	void evict(const std::string& file, unsigned flags);
+
+	State state(const Texture* tex) const;
+	bool isResident(const std::string& file, unsigned flags) const;
+	bool isResident(const Texture* tex) const;
+	bool isLoading() const;
+
+	/// Uploads at most maxUploads decoded images. Call it once per frame.
+	unsigned update(unsigned maxUploads = unsigned(-1));
+
+	/// Ratio between the size of the loaded texture and the source image.
+	float scale(const Texture* tex) const;
+
+	TextureCache* cache();
+
+	/// Appends the resident textures to textures.
+	void residentTextures(std::vector<Texture*>* textures) const;
+	size_t residentBytes() const;
+	/// Total size of the images uploaded so far.
+	uint64 uploadedBytes() const;
+	InfoList residency() const;
+	void logResidency();
+
+protected:
+	struct DecodedImage {
+		std::string           variant;
+		unsigned              downscale;
+		unsigned              width;
+		unsigned              height;
+		/// Built by the worker, so that the upload does not copy.
+		std::unique_ptr<lair::Image>
+		                      pixels;
+	};
+	typedef std::shared_ptr<DecodedImage> ImageSP;
+
+	struct Entry {
+		TextureInfo              info;
+		std::unique_ptr<Texture> texture;
+		unsigned                 flags;
+		float                    displayScale;
+		unsigned                 requested;   // Downscale of the last load.
+		unsigned                 generation;
+	};
+
+	struct Decoded {
+		std::string key;
+		unsigned    generation;
+		ImageSP     image;
+	};
+
+	typedef std::unordered_map<std::string, Entry> EntryMap;
+	typedef std::unordered_map<const Texture*, Entry*> TextureMap;
+	typedef std::deque<Decoded> DecodedQueue;
+
+protected:
+	static std::string entryKey(const std::string& file, unsigned flags);
+	Entry& entry(const std::string& file, unsigned flags, float displayScale);
+	void reselect(Entry& entry);
+	void evict(Entry& entry);
+	unsigned idealDownscale(const Entry& entry) const;
+	size_t availableBytes() const;
+	void upload(Entry& entry, const DecodedImage& image);
+
+	ImageSP decode(const std::string& file, unsigned flags, unsigned downscale,
+	               size_t available) const;
+
+	std::string variantFile(const std::string& file, unsigned downscale) const;
+	bool imageSize(const std::string& file, unsigned* width, unsigned* height) const;
+
+protected:
+	Game*        _game;
+
+	size_t       _budget;
+	float        _viewScale;
+
+	TextureCache _cache;
+
+	EntryMap     _entries;
+	TextureMap   _textures;
+	size_t       _residentBytes;
+	uint64       _uploadedBytes;
+	unsigned     _nLoading;
+
+	std::mutex   _decodedMutex;
+	std::condition_variable
+	             _decodedCond;
+	DecodedQueue _decoded;
+};
+
+
+#endif
@@ -0,0 +1,271 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+#include "trace.h"
+
+
+void writeJsonString(std::ostream& out, const char* str) {
+	out << '"';
+	for(; *str; ++str) {
+		unsigned char c = *str;
+		if(c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if(c < 0x20) {
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			out << escaped;
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+
+struct Tracer::ThreadBuffer {
+	unsigned            id;
+	std::atomic<const char*>
+	                    name;
+	/// Number of events written so far. The last TRACE_BUFFER_EVENTS ones
+	/// are kept, event n is at n % TRACE_BUFFER_EVENTS.
+	std::atomic<uint64> count;
+	Event               events[TRACE_BUFFER_EVENTS];
+};
+
+
+static thread_local Tracer::ThreadBuffer* currentBuffer = nullptr;
+
+
+Tracer::Tracer()
+    : _enabled(false),
+      _nextFlowId(1),
+      _startTime(now()),
+      _buffersMutex(),
+      _buffers() {
+}
+
+
+Tracer::~Tracer() {
+}
+
+
+Tracer& Tracer::instance() {
+	static Tracer tracer;
+	return tracer;
+}
+
+
+uint64 Tracer::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+	            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void Tracer::setEnabled(bool enabled) {
+	_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+
+void Tracer::setThreadName(const char* name) {
+	if(isEnabled()) {
+		threadBuffer()->name.store(name, std::memory_order_release);
+	}
+}
+
+
+uint64 Tracer::newFlowId() {
+	return _nextFlowId.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+Tracer::ThreadBuffer* Tracer::createBuffer(const char* name) {
+	return isEnabled()? addBuffer(name): nullptr;
+}
+
+
+void Tracer::useBuffer(ThreadBuffer* buffer) {
+	if(buffer) {
+		currentBuffer = buffer;
+	}
+}
+
+
+bool Tracer::exportJson(const std::string& file) const {
+	std::ofstream out(file);
+	if(!out) {
+		return false;
+	}
+
+	std::unique_lock<std::mutex> lock(_buffersMutex);
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	for(const ThreadBufferUP& buffer: _buffers) {
+		const char* name = buffer->name.load(std::memory_order_acquire);
+		if(name) {
+			out << (first? "": ",\n")
+			    << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+			    << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+			writeJsonString(out, name);
+			out << "}}";
+			first = false;
+		}
+		writeEvents(out, *buffer, &first);
+	}
+	out << "\n]}\n";
+
+	return bool(out);
+}
+
+
+// Only the owning thread writes to its buffer.
+void Tracer::write(uint64 time, Type type, const char* name, int64 value,
+                   const char* detail) {
+	ThreadBuffer* buffer = threadBuffer();
+	uint64 count = buffer->count.load(std::memory_order_relaxed);
+
+	Event& event = buffer->events[count % TRACE_BUFFER_EVENTS];
+	event.time  = time;
+	event.name  = name;
+	event.value = value;
+	event.type  = type;
+	if(detail) {
+		std::strncpy(event.detail, detail, TRACE_DETAIL_SIZE - 1);
+		event.detail[TRACE_DETAIL_SIZE - 1] = '\0';
+	} else {
+		event.detail[0] = '\0';
+	}
+	buffer->count.store(count + 1, std::memory_order_release);
+}
+
+
+Tracer::ThreadBuffer* Tracer::threadBuffer() {
+	if(!currentBuffer) {
+		currentBuffer = addBuffer(nullptr);
+	}
+	return currentBuffer;
+}
+
+
+Tracer::ThreadBuffer* Tracer::addBuffer(const char* name) {
+	ThreadBuffer* buffer = new ThreadBuffer;
+	buffer->name.store(name, std::memory_order_relaxed);
+	buffer->count.store(0, std::memory_order_relaxed);
+
+	std::unique_lock<std::mutex> lock(_buffersMutex);
+	buffer->id = _buffers.size() + 1;
+	_buffers.emplace_back(buffer);
+	return buffer;
+}
+
+
+// Writes the events still in buffer. The owning thread may keep recording:
+// events overwritten during the copy are dropped as well.
+void Tracer::writeEvents(std::ostream& out, const ThreadBuffer& buffer, bool* first) const {
+	uint64 end   = buffer.count.load(std::memory_order_acquire);
+	uint64 begin = (end > TRACE_BUFFER_EVENTS)? end - TRACE_BUFFER_EVENTS: 0;
+	std::vector<Event> events;
+	events.reserve(end - begin);
+	for(uint64 i = begin; i < end; ++i) {
+		events.push_back(buffer.events[i % TRACE_BUFFER_EVENTS]);
+	}
+	uint64 closeTime = now();
+
+	uint64 written = buffer.count.load(std::memory_order_acquire);
+	uint64 skip    = 0;
+	if(written > TRACE_BUFFER_EVENTS && written - TRACE_BUFFER_EVENTS > begin) {
+		skip = std::min(written - TRACE_BUFFER_EVENTS - begin, end - begin);
+	}
+	if(begin + skip > 0 && skip < events.size()) {
+		out << (*first? "": ",\n")
+		    << "{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":" << buffer.id
+		    << ",\"ts\":" << double(events[skip].time - _startTime) / 1000.
+		    << ",\"name\":\"events dropped\",\"args\":{\"dropped\":"
+		    << (begin + skip) << "}}";
+		*first = false;
+	}
+
+	static const char* phases[] = { "B", "E", "C", "i", "s", "f", "X" };
+	char prefix[128];
+	auto writePrefix = [&](Type type, uint64 time, const char* name) {
+		std::snprintf(prefix, sizeof(prefix),
+		              "{\"ph\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"cat\":\"ahie\",\"name\":",
+		              phases[type], buffer.id, double(time - _startTime) / 1000.);
+		out << (*first? "": ",\n") << prefix;
+		writeJsonString(out, name);
+		*first = false;
+	};
+
+	// Slices are kept whole: an end whose begin was overwritten is dropped,
+	// and the slices still open are closed at the time of the export.
+	std::vector<const char*> open;
+	for(size_t i = skip; i < events.size(); ++i) {
+		const Event& event = events[i];
+		if(event.type == END) {
+			if(open.empty()) {
+				continue;
+			}
+			open.pop_back();
+		} else if(event.type == BEGIN) {
+			open.push_back(event.name);
+		}
+
+		writePrefix(event.type, event.time, event.name);
+		switch(event.type) {
+		case BEGIN:
+			if(event.detail[0]) {
+				out << ",\"args\":{\"detail\":";
+				writeJsonString(out, event.detail);
+				out << "}";
+			}
+			break;
+		case COUNTER:
+			out << ",\"args\":{\"value\":" << event.value << "}";
+			break;
+		case INSTANT:
+			out << ",\"s\":\"t\"";
+			break;
+		case FLOW_BEGIN:
+			out << ",\"id\":" << event.value;
+			break;
+		case FLOW_END:
+			out << ",\"id\":" << event.value << ",\"bp\":\"e\"";
+			break;
+		case COMPLETE:
+			out << ",\"dur\":" << double(event.value) / 1000.;
+			break;
+		case END:
+			break;
+		}
+		out << "}";
+	}
+
+	while(!open.empty()) {
+		writePrefix(END, closeTime, open.back());
+		out << "}";
+		open.pop_back();
+	}
+}
@@ -0,0 +1,195 @@
+//
+//  Copyright (C) 2015 the authors (see AUTHORS)
+//
+//  This file is part of alice_hie.
+//
+//  lair is free software: you can redistribute it and/or modify it
+//  under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  lair is distributed in the hope that it will be useful, but
+//  WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with lair.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef _AHIE_TRACE_H
+#define _AHIE_TRACE_H
+
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+
+#include <lair/core/lair.h>
+
+
+#define TRACE_BUFFER_EVENTS 16384
+#define TRACE_DETAIL_SIZE   40
+#define TRACE_FILE          "trace.json"
+
+
+using namespace lair;
+
+
+#define AHIE_TRACE_CAT2(a, b) a ## b
+#define AHIE_TRACE_CAT(a, b) AHIE_TRACE_CAT2(a, b)
+
+/// Records the rest of the enclosing scope. name must be a string literal
+/// (only the pointer is stored); detail is copied and may be truncated.
+#define TRACE_SCOPE(name) \
+	TraceScope AHIE_TRACE_CAT(_traceScope, __LINE__)((name))
+#define TRACE_SCOPE_DETAIL(name, detail) \
+	TraceScope AHIE_TRACE_CAT(_traceScope, __LINE__)((name), (detail))
+/// Records a slice timed elsewhere; begin and end are on the trace clock.
+#define TRACE_SLICE(name, begin, end) \
+	Tracer::instance().recordSlice((name), (begin), (end))
+#define TRACE_COUNTER(name, value) \
+	Tracer::instance().record(Tracer::COUNTER, (name), (value))
+#define TRACE_INSTANT(name) \
+	Tracer::instance().record(Tracer::INSTANT, (name))
+/// Arrows between slices, e.g. from a request to the task that handles it.
+/// Both ends must be inside a scope.
+#define TRACE_FLOW_BEGIN(name, id) \
+	Tracer::instance().record(Tracer::FLOW_BEGIN, (name), (id))
+#define TRACE_FLOW_END(name, id) \
+	Tracer::instance().record(Tracer::FLOW_END, (name), (id))
+#define TRACE_THREAD_NAME(name) \
+	Tracer::instance().setThreadName((name))
+
+
+/// Timeline of the main, loader and audio threads, exported in the Chrome
+/// trace event format (chrome://tracing, ui.perfetto.dev).
+///
+/// Each thread records in its own fixed-size ring buffer, allocated on its
+/// first event: recording takes no lock and never allocates after that.
+/// Threads that must not allocate, like the audio callback, get a buffer
+/// created beforehand with createBuffer() and call useBuffer(). Full buffers
+/// overwrite their oldest events; the export then drops the slices whose
+/// begin was lost and closes the slices that are still open. Disabled
+/// tracing costs a relaxed atomic load per macro.
+class Tracer {
+public:
+	enum Type {
+		BEGIN,
+		END,
+		COUNTER,
+		INSTANT,
+		FLOW_BEGIN,
+		FLOW_END,
+		COMPLETE
+	};
+
+	struct ThreadBuffer;
+
+public:
+	Tracer(const Tracer&) = delete;
+	~Tracer();
+
+	Tracer& operator=(const Tracer&) = delete;
+
+	static Tracer& instance();
+
+	/// Clock of the trace, in nanoseconds. Also used by the startup report.
+	static uint64 now();
+
+	inline bool isEnabled() const {
+		return _enabled.load(std::memory_order_relaxed);
+	}
+	void setEnabled(bool enabled);
+
+	/// Names the calling thread in the trace.
+	void setThreadName(const char* name);
+	uint64 newFlowId();
+
+	/// Allocates a named buffer for a thread that will call useBuffer().
+	/// Returns null if tracing is disabled.
+	ThreadBuffer* createBuffer(const char* name);
+	/// Makes the calling thread record in buffer, if not null. Takes no lock.
+	void useBuffer(ThreadBuffer* buffer);
+
+	inline void record(Type type, const char* name, int64 value = 0,
+	                   const char* detail = nullptr) {
+		if(isEnabled()) {
+			write(now(), type, name, value, detail);
+		}
+	}
+
+	inline void recordSlice(const char* name, uint64 begin, uint64 end) {
+		if(isEnabled()) {
+			write(begin, COMPLETE, name, end - begin, nullptr);
+		}
+	}
+
+	/// Can be called while other threads record; their events after the
+	/// call are not exported.
+	bool exportJson(const std::string& file) const;
+
+protected:
+	struct Event {
+		uint64      time;
+		const char* name;
+		int64       value;
+		Type        type;
+		char        detail[TRACE_DETAIL_SIZE];
+	};
+
+	typedef std::unique_ptr<ThreadBuffer> ThreadBufferUP;
+
+protected:
+	Tracer();
+
+	void write(uint64 time, Type type, const char* name, int64 value,
+	           const char* detail);
+	ThreadBuffer* threadBuffer();
+	ThreadBuffer* addBuffer(const char* name);
+	void writeEvents(std::ostream& out, const ThreadBuffer& buffer, bool* first) const;
+
+protected:
+	std::atomic<bool>   _enabled;
+	std::atomic<uint64> _nextFlowId;
+	uint64              _startTime;
+
+	// Buffers live as long as the tracer, so that the events of finished
+	// threads can still be exported.
+	mutable std::mutex          _buffersMutex;
+	std::vector<ThreadBufferUP> _buffers;
+};
+
+
+/// Writes str as a JSON string literal, escaped.
+void writeJsonString(std::ostream& out, const char* str);
+
+
+class TraceScope {
+public:
+	inline TraceScope(const char* name, const char* detail = nullptr)
+	    : _name(Tracer::instance().isEnabled()? name: nullptr) {
+		if(_name) {
+			Tracer::instance().record(Tracer::BEGIN, name, 0, detail);
+		}
+	}
+
+	// Not recorded if tracing was enabled within the scope.
+	inline ~TraceScope() {
+		if(_name) {
+			Tracer::instance().record(Tracer::END, _name);
+		}
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* _name;
+};
+
+
+#endif